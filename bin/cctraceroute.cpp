@@ -1,9 +1,18 @@
+#include <chrono>
 #include <cxxopts.hpp>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "monitor.hpp"
+#include "topology.hpp"
 #include "traceroute.hpp"
 
 cxxopts::ParseResult parse_cmd(int argc, char** argv) {
@@ -12,11 +21,19 @@ cxxopts::ParseResult parse_cmd(int argc, char** argv) {
                            "packets will take from one computer to another over a network.");
   // clang-format off
   options.add_options()
-    ("hostname", "Target host name", cxxopts::value<std::string>())
+    ("hostname", "Target host names or IP addresses", cxxopts::value<std::vector<std::string>>())
     ("m,maxhops", "Max hops", cxxopts::value<int>()->default_value("64"))
     ("t,text", "Message text", cxxopts::value<std::string>()->default_value("codingchallenges.fyi trace route"))
     ("w,timeout", "Timeout in milliseconds", cxxopts::value<int>()->default_value("100"))
     ("q,queries", "Number of probes per hop", cxxopts::value<int>()->default_value("3"))
+    ("capture", "Record sent probes and received ICMP packets to a pcap file", cxxopts::value<std::string>())
+    ("replay", "Answer probes from a pcap file recorded with --capture", cxxopts::value<std::string>())
+    ("topology", "Add the trace to a topology snapshot file", cxxopts::value<std::string>())
+    ("asn", "Tag hops with their origin AS from a prebuilt prefix-to-ASN table", cxxopts::value<std::string>())
+    ("asn-build", "Build the --asn table from a dataset of \"prefix/length asn\" lines", cxxopts::value<std::string>())
+    ("midpath", "Estimate the path length and start probing from the middle of the path")
+    ("c,cycles", "Monitor for this many cycles, reporting only path changes", cxxopts::value<int>()->default_value("1"))
+    ("i,interval", "Milliseconds between monitoring cycles", cxxopts::value<int>()->default_value("1000"))
     ("h,help", "Print help");
   // clang-format on
   options.parse_positional({"hostname"});
@@ -31,15 +48,157 @@ cxxopts::ParseResult parse_cmd(int argc, char** argv) {
 
 int main(int argc, char** argv) {
   auto result = parse_cmd(argc, argv);
-  std::string host_name = result["hostname"].as<std::string>();
+  auto host_names = result["hostname"].as<std::vector<std::string>>();
   int max_hops = result["maxhops"].as<int>();
   std::string message = result["text"].as<std::string>();
   auto timeout = std::chrono::milliseconds(result["timeout"].as<int>());
   int queries = result["queries"].as<int>();
 
-  TraceRoute traceroute(host_name, max_hops, queries, message, std::make_unique<SystemDnsResolver>(),
-                        std::make_unique<NetworkProber>(timeout));
-  traceroute.run(std::cout);
+  if (result.count("asn-build") && !result.count("asn")) {
+    std::cerr << "cctraceroute: --asn-build needs --asn to name the table to build" << std::endl;
+    return 1;
+  }
+
+  std::shared_ptr<PcapWriter> capture;
+  if (result.count("capture")) {
+    capture = std::make_shared<PcapWriter>(result["capture"].as<std::string>());
+  }
+  // One replay prober serves every target, so a destination traced several times live replays each of
+  // its runs in turn rather than the first one again
+  std::shared_ptr<ReplayProber> replay_prober;
+  std::vector<std::string> recorded_destinations;
+  if (result.count("replay")) {
+    replay_prober = std::make_shared<ReplayProber>(result["replay"].as<std::string>());
+    recorded_destinations = replay_prober->destinations();
+  }
+  auto make_prober = [&]() -> std::unique_ptr<Prober> {
+    if (replay_prober) {
+      return std::make_unique<SharedProber>(replay_prober);
+    }
+    return std::make_unique<NetworkProber>(timeout, capture);
+  };
+  // Replay makes no DNS lookups, so a capture replays the same way wherever and whenever it runs
+  auto make_resolver = [&]() -> std::unique_ptr<DnsResolver> {
+    if (replay_prober) {
+      return std::make_unique<OfflineDnsResolver>(recorded_destinations);
+    }
+    return std::make_unique<SystemDnsResolver>();
+  };
+
+  // Hostnames are resolved concurrently; tracing starts as soon as the first address is known
+  auto resolver = make_resolver();
+  BatchResolver batch(*resolver);
+  int exit_code = 0;
+  auto report_failure = [&](const std::string& host_name, const std::string& error) {
+    std::cerr << "cctraceroute: " << host_name << ": " << error << std::endl;
+    exit_code = 1;
+  };
+
+  std::optional<TopologyStore> topology;
+  std::string snapshot = result.count("topology") ? result["topology"].as<std::string>() : "";
+  if (!snapshot.empty()) {
+    topology = std::filesystem::exists(snapshot) ? TopologyStore::load(snapshot) : TopologyStore();
+  }
+
+  int cycles = result["cycles"].as<int>();
+  if (cycles > 1) {
+    // Monitoring re-probes a few sampled hops instead of tracing, so per-trace options have nothing to act on
+    for (const char* option : {"midpath", "asn"}) {
+      if (result.count(option)) {
+        std::cerr << "cctraceroute: --" << option << " cannot be combined with --cycles" << std::endl;
+        return 1;
+      }
+    }
 
-  return 0;
+    auto interval = std::chrono::milliseconds(result["interval"].as<int>());
+    std::vector<std::pair<std::string, std::string>> targets;
+    batch.resolve_all(host_names, [&](const std::string& host_name, const BatchResolver::Result& ip) {
+      if (!ip) {
+        report_failure(host_name, ip.error());
+        return;
+      }
+      std::cout << "monitoring " << host_name << " (" << *ip << "), " << cycles << " cycles" << std::endl;
+      targets.emplace_back(host_name, *ip);
+    });
+
+    PathMonitor monitor(max_hops, queries, message, make_prober());
+    for (int cycle = 1; cycle <= cycles; ++cycle) {
+      for (const auto& [host_name, ip] : targets) {
+        std::vector<PathChange> changes;
+        try {
+          changes = monitor.check(ip);
+        } catch (const std::runtime_error& e) {
+          report_failure(host_name, e.what());
+          continue;
+        }
+        if (!changes.empty()) {
+          std::cout << "cycle " << cycle << ": path to " << host_name << " (" << ip << ") changed" << std::endl;
+          for (const auto& change : changes) {
+            print_path_change(std::cout, change);
+          }
+          // Each distinct path seen goes into the topology, not every cycle's unchanged one
+          if (topology) {
+            topology->add_trace(ip, *monitor.known_path(ip));
+          }
+        }
+      }
+      // A replay has nothing to wait for between cycles, so it keeps running faster than real time
+      if (cycle < cycles && !replay_prober) {
+        std::this_thread::sleep_for(interval);
+      }
+    }
+    if (topology) {
+      topology->save(snapshot);
+    }
+    return exit_code;
+  }
+
+  std::shared_ptr<LocalStopSet> stop_set;
+  if (result.count("midpath")) {
+    stop_set = std::make_shared<LocalStopSet>();
+  }
+  std::shared_ptr<const AsnTable> asn_table;
+  if (result.count("asn")) {
+    std::string table_path = result["asn"].as<std::string>();
+    if (result.count("asn-build")) {
+      std::ifstream dataset(result["asn-build"].as<std::string>());
+      if (!dataset) {
+        throw std::runtime_error("Failed to open ASN dataset: " + result["asn-build"].as<std::string>());
+      }
+      AsnTableBuilder builder;
+      builder.add_dataset(dataset);
+      builder.write(table_path);
+    }
+    asn_table = std::make_shared<AsnTable>(table_path);
+  }
+  batch.resolve_all(host_names, [&](const std::string& host_name, const BatchResolver::Result& ip) {
+    if (!ip) {
+      report_failure(host_name, ip.error());
+      return;
+    }
+
+    TraceRoute traceroute(host_name, max_hops, queries, message, make_resolver(), make_prober());
+    if (stop_set) {
+      traceroute.enable_midpath_start(stop_set);
+    }
+    if (asn_table) {
+      traceroute.enable_asn_annotation(asn_table);
+    }
+    TraceResult trace;
+    try {
+      trace = traceroute.run(std::cout, *ip);
+    } catch (const std::runtime_error& e) {
+      // e.g. a replayed capture that holds no probe to this address
+      report_failure(host_name, e.what());
+      return;
+    }
+    if (topology) {
+      topology->add_trace(trace.destination_ip, trace.hops);
+    }
+  });
+
+  if (topology) {
+    topology->save(snapshot);
+  }
+  return exit_code;
 }
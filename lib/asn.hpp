@@ -0,0 +1,219 @@
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mmap.hpp"
+
+// Origin AS of the longest prefix covering an address. Addresses are in host byte order.
+struct AsnInfo {
+  uint32_t asn;
+  uint32_t prefix;
+  uint32_t prefix_length;
+
+  std::string prefix_string() const {
+    uint32_t addr = htonl(prefix);
+    char ip[INET_ADDRSTRLEN]{};
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    return std::string(ip) + "/" + std::to_string(prefix_length);
+  }
+};
+
+// Prefix-to-ASN tables use the DIR-24-8 layout: one entry per /24 (tbl24), plus a 256-entry group (tbl8)
+// for each /24 that holds longer prefixes. Any lookup is then one or two array reads. An entry is 0 for
+// no route, the index + 1 of the matching AsnInfo record, or kAsnTbl8Flag | group number.
+constexpr uint64_t kAsnTableMagic = 0x31304e53414343ULL;  // "CCASN01"
+constexpr uint32_t kAsnTbl8Flag = 0x80000000;
+constexpr std::size_t kAsnTbl24Size = std::size_t{1} << 24;
+constexpr std::size_t kAsnTbl8GroupSize = 256;
+
+struct AsnTableHeader {
+  uint64_t magic;
+  uint32_t record_count;
+  uint32_t tbl8_group_count;
+};
+
+// Builds a table file from a prefix-to-ASN dataset. The file is written in host byte order and with
+// holes where the tables are empty, so it only takes disk space for the address ranges it covers.
+class AsnTableBuilder {
+ public:
+  void add(uint32_t prefix, uint32_t prefix_length, uint32_t asn) {
+    if (prefix_length > 32) {
+      throw std::invalid_argument("Invalid prefix length: " + std::to_string(prefix_length));
+    }
+    uint32_t mask = prefix_length == 0 ? 0 : ~uint32_t{0} << (32 - prefix_length);
+    records_.push_back({.asn = asn, .prefix = prefix & mask, .prefix_length = prefix_length});
+  }
+
+  // One "prefix/length asn" pair per line, e.g. "8.8.8.0/24 15169". Blank lines and lines starting
+  // with '#' are skipped.
+  void add_dataset(std::istream& in) {
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line)) {
+      ++line_number;
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+
+      std::istringstream fields(line);
+      std::string cidr;
+      uint32_t asn = 0;
+      auto slash = std::string::npos;
+      if (!(fields >> cidr >> asn) || (slash = cidr.find('/')) == std::string::npos) {
+        throw std::runtime_error("Malformed ASN dataset line " + std::to_string(line_number) + ": " + line);
+      }
+
+      uint32_t addr = 0;
+      uint32_t prefix_length = 0;
+      const char* length_end = cidr.data() + cidr.size();
+      if (inet_pton(AF_INET, cidr.substr(0, slash).c_str(), &addr) != 1 ||
+          std::from_chars(cidr.data() + slash + 1, length_end, prefix_length).ptr != length_end) {
+        throw std::runtime_error("Malformed ASN dataset line " + std::to_string(line_number) + ": " + line);
+      }
+      add(ntohl(addr), prefix_length, asn);
+    }
+  }
+
+  void write(const std::string& path) {
+    // Shorter prefixes go in first so longer ones overwrite the ranges they refine
+    std::stable_sort(records_.begin(), records_.end(),
+                     [](const AsnInfo& a, const AsnInfo& b) { return a.prefix_length < b.prefix_length; });
+
+    std::vector<uint32_t> tbl24(kAsnTbl24Size, 0);
+    std::vector<uint32_t> tbl8;
+    for (uint32_t i = 0; i < records_.size(); ++i) {
+      const AsnInfo& record = records_[i];
+      const uint32_t entry = i + 1;
+
+      if (record.prefix_length <= 24) {
+        auto first = tbl24.begin() + (record.prefix >> 8);
+        std::fill(first, first + (std::size_t{1} << (24 - record.prefix_length)), entry);
+        continue;
+      }
+
+      uint32_t& slot = tbl24[record.prefix >> 8];
+      if (!(slot & kAsnTbl8Flag)) {
+        uint32_t group = static_cast<uint32_t>(tbl8.size() / kAsnTbl8GroupSize);
+        tbl8.resize(tbl8.size() + kAsnTbl8GroupSize, slot);
+        slot = kAsnTbl8Flag | group;
+      }
+      auto first = tbl8.begin() + (slot & ~kAsnTbl8Flag) * kAsnTbl8GroupSize + (record.prefix & 0xff);
+      std::fill(first, first + (std::size_t{1} << (32 - record.prefix_length)), entry);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Failed to open ASN table: " + path);
+    }
+    AsnTableHeader header{.magic = kAsnTableMagic,
+                          .record_count = static_cast<uint32_t>(records_.size()),
+                          .tbl8_group_count = static_cast<uint32_t>(tbl8.size() / kAsnTbl8GroupSize)};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(records_.data()),
+              static_cast<std::streamsize>(records_.size() * sizeof(AsnInfo)));
+    write_sparse(out, tbl24);
+    write_sparse(out, tbl8);
+
+    const auto size = static_cast<std::uintmax_t>(out.tellp());
+    out.close();
+    if (!out) {
+      throw std::runtime_error("Failed to write ASN table: " + path);
+    }
+    // Trailing holes are only allocated once the file is extended to its full size
+    std::filesystem::resize_file(path, size);
+  }
+
+ private:
+  static void write_sparse(std::ofstream& out, const std::vector<uint32_t>& entries) {
+    constexpr std::size_t kChunk = 4096 / sizeof(uint32_t);
+    for (std::size_t i = 0; i < entries.size(); i += kChunk) {
+      const std::size_t count = std::min(kChunk, entries.size() - i);
+      const auto* first = entries.data() + i;
+      const auto bytes = static_cast<std::streamoff>(count * sizeof(uint32_t));
+      if (std::all_of(first, first + count, [](uint32_t entry) { return entry == 0; })) {
+        out.seekp(bytes, std::ios::cur);
+      } else {
+        out.write(reinterpret_cast<const char*>(first), bytes);
+      }
+    }
+  }
+
+  std::vector<AsnInfo> records_;
+};
+
+// A table file built by AsnTableBuilder, mapped into memory as is. Opening it reads nothing but the
+// header; the pages a lookup touches are faulted in on demand.
+class AsnTable {
+ public:
+  explicit AsnTable(const std::string& path) : file_(path) {
+    auto bytes = file_.bytes();
+    AsnTableHeader header{};
+    if (bytes.size() < sizeof(header)) {
+      throw std::runtime_error("ASN table too short: " + path);
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != kAsnTableMagic) {
+      throw std::runtime_error("Not an ASN table: " + path);
+    }
+
+    const std::size_t records_offset = sizeof(header);
+    const std::size_t tbl24_offset = records_offset + header.record_count * sizeof(AsnInfo);
+    const std::size_t tbl8_offset = tbl24_offset + kAsnTbl24Size * sizeof(uint32_t);
+    const std::size_t end = tbl8_offset + header.tbl8_group_count * kAsnTbl8GroupSize * sizeof(uint32_t);
+    if (bytes.size() != end) {
+      throw std::runtime_error("Corrupt ASN table: " + path);
+    }
+
+    records_ = reinterpret_cast<const AsnInfo*>(bytes.data() + records_offset);
+    record_count_ = header.record_count;
+    tbl24_ = reinterpret_cast<const uint32_t*>(bytes.data() + tbl24_offset);
+    tbl8_ = reinterpret_cast<const uint32_t*>(bytes.data() + tbl8_offset);
+    tbl8_group_count_ = header.tbl8_group_count;
+  }
+
+  std::optional<AsnInfo> lookup(uint32_t addr) const {
+    uint32_t entry = tbl24_[addr >> 8];
+    if (entry & kAsnTbl8Flag) {
+      const uint32_t group = entry & ~kAsnTbl8Flag;
+      if (group >= tbl8_group_count_) {
+        return std::nullopt;
+      }
+      entry = tbl8_[group * kAsnTbl8GroupSize + (addr & 0xff)];
+    }
+    if (entry == 0 || entry > record_count_) {
+      return std::nullopt;
+    }
+    return records_[entry - 1];
+  }
+
+  std::optional<AsnInfo> lookup(std::string_view ip) const {
+    std::string ip_str(ip);
+    uint32_t addr = 0;
+    if (inet_pton(AF_INET, ip_str.c_str(), &addr) != 1) {
+      return std::nullopt;
+    }
+    return lookup(ntohl(addr));
+  }
+
+ private:
+  MappedFile file_;
+  const AsnInfo* records_ = nullptr;
+  uint32_t record_count_ = 0;
+  const uint32_t* tbl24_ = nullptr;
+  const uint32_t* tbl8_ = nullptr;
+  uint32_t tbl8_group_count_ = 0;
+};
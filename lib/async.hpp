@@ -0,0 +1,496 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "icmp.hpp"
+#include "pcap.hpp"
+#include "prober.hpp"
+
+// Asynchronous tracing for applications that embed the library. Traces are coroutines that suspend
+// while a probe is in flight, and a Reactor owned by the host application resumes them as replies
+// arrive or probes time out. A reactor and everything running on it belong to one thread; run one
+// reactor per thread to spread traces over several threads.
+
+// Non-blocking probe I/O underneath a Reactor
+class ProbeTransport {
+ public:
+  virtual ~ProbeTransport() = default;
+  virtual void send(std::string_view dest_ip, int port, int ttl, std::string_view payload) = 0;
+  // The next ICMP packet already received, or nullopt without waiting if there is none
+  virtual std::optional<IcmpResponse> receive() = 0;
+  // Blocks until a packet may be available or the timeout expires
+  virtual void wait(std::chrono::milliseconds timeout) = 0;
+};
+
+// Every raw ICMP socket on the host sees every ICMP packet, including replies to other transports' probes.
+// Probes all leave from one UDP socket with its own source port, and replies quoting another source port
+// are dropped here, so transports in other reactors or processes never see each other's replies.
+class NetworkTransport : public ProbeTransport {
+ public:
+  explicit NetworkTransport(std::shared_ptr<PcapWriter> capture = nullptr)
+      : sender_(1), source_port_(sender_.bind_local_port()), capture_(std::move(capture)) {
+    icmp_fd_ = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK, IPPROTO_ICMP);
+    if (icmp_fd_ < 0) {
+      throw std::runtime_error("Failed to create ICMP socket (need root/CAP_NET_RAW)");
+    }
+  }
+
+  ~NetworkTransport() { close(icmp_fd_); }
+
+  NetworkTransport(const NetworkTransport&) = delete;
+  NetworkTransport& operator=(const NetworkTransport&) = delete;
+
+  void send(std::string_view dest_ip, int port, int ttl, std::string_view payload) override final {
+    sender_.set_ttl(ttl);
+    sender_.send(dest_ip, port, payload);
+    if (capture_) {
+      capture_->write(make_probe_packet(dest_ip, port, ttl, payload));
+    }
+  }
+
+  std::optional<IcmpResponse> receive() override final {
+    while (true) {
+      std::array<uint8_t, 1500> buffer{};
+      struct sockaddr_in from_addr{};
+      socklen_t from_len = sizeof(from_addr);
+
+      ssize_t bytes = recvfrom(icmp_fd_, buffer.data(), buffer.size(), 0,
+                               reinterpret_cast<struct sockaddr*>(&from_addr), &from_len);
+      if (bytes < 0) {
+        return std::nullopt;
+      }
+
+      std::span<const uint8_t> packet(buffer.data(), static_cast<std::size_t>(bytes));
+      if (capture_) {
+        capture_->write(packet);
+      }
+
+      auto icmp = parse_icmp(packet);
+      if (icmp && icmp->original_source_port != source_port_) {
+        continue;
+      }
+      char ip_str[INET_ADDRSTRLEN]{};
+      inet_ntop(AF_INET, &from_addr.sin_addr, ip_str, sizeof(ip_str));
+      return IcmpResponse{.sender_ip = std::string(ip_str), .icmp = icmp};
+    }
+  }
+
+  void wait(std::chrono::milliseconds timeout) override final {
+    struct pollfd pfd{.fd = icmp_fd_, .events = POLLIN, .revents = 0};
+    poll(&pfd, 1, static_cast<int>(timeout.count()));
+  }
+
+ private:
+  UdpSender sender_;
+  uint16_t source_port_;
+  int icmp_fd_;
+  std::shared_ptr<PcapWriter> capture_;
+};
+
+template <typename T>
+struct TaskStorage {
+  std::optional<T> value;
+  void return_value(T v) { value = std::move(v); }
+  T take() { return std::move(*value); }
+};
+
+template <>
+struct TaskStorage<void> {
+  void return_void() {}
+  void take() {}
+};
+
+// A lazily started coroutine producing a T. Awaiting it starts it and resumes the awaiter when it
+// finishes, rethrowing anything it threw.
+template <typename T = void>
+class [[nodiscard]] Task {
+ public:
+  struct promise_type : TaskStorage<T> {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept {
+      struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+          auto continuation = h.promise().continuation;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+      return FinalAwaiter{};
+    }
+    void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  ~Task() { destroy(); }
+
+  auto operator co_await() noexcept {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return handle.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+      T await_resume() { return take_result(handle); }
+    };
+    return Awaiter{handle_};
+  }
+
+  // For running a task without awaiting it, as Reactor::spawn does
+  void start() { handle_.resume(); }
+  bool done() const { return handle_.done(); }
+  T result() { return take_result(handle_); }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  static T take_result(std::coroutine_handle<promise_type> handle) {
+    if (handle.promise().exception) {
+      std::rethrow_exception(handle.promise().exception);
+    }
+    return handle.promise().take();
+  }
+
+  void destroy() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+struct TraceHop {
+  int ttl;
+  HopResult hop;
+};
+
+// Asynchronous sequence of hops. `co_await stream.next()` resumes the trace until its next hop and
+// returns it, or nullopt once the trace is over. Destroying the stream cancels the trace, including
+// any probe it has in flight.
+class [[nodiscard]] HopStream {
+ public:
+  struct promise_type {
+    std::optional<TraceHop> current;
+    std::coroutine_handle<> consumer;
+    std::exception_ptr exception;
+
+    struct ToConsumer {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        auto consumer = h.promise().consumer;
+        return consumer ? consumer : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+
+    HopStream get_return_object() { return HopStream(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    ToConsumer final_suspend() noexcept { return {}; }
+    ToConsumer yield_value(TraceHop hop) {
+      current = std::move(hop);
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  HopStream(HopStream&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  HopStream& operator=(HopStream&& other) noexcept {
+    if (this != &other) {
+      destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  ~HopStream() { destroy(); }
+
+  auto next() noexcept {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return handle.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+        handle.promise().consumer = consumer;
+        handle.promise().current.reset();
+        return handle;
+      }
+      std::optional<TraceHop> await_resume() {
+        if (handle.promise().exception) {
+          std::rethrow_exception(handle.promise().exception);
+        }
+        return std::move(handle.promise().current);
+      }
+    };
+    return Awaiter{handle_};
+  }
+
+ private:
+  explicit HopStream(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  void destroy() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+class Reactor {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Completes with the reply to one probe, or a timed out hop once `deadline` passes or `stop` is requested
+  class ProbeAwaiter {
+   public:
+    ProbeAwaiter(Reactor& reactor, std::string dest_ip, int ttl, std::string payload, Clock::time_point deadline,
+                 std::stop_token stop)
+        : reactor_(reactor),
+          dest_ip_(std::move(dest_ip)),
+          ttl_(ttl),
+          payload_(std::move(payload)),
+          deadline_(deadline),
+          stop_(std::move(stop)) {
+      inet_pton(AF_INET, dest_ip_.c_str(), &dest_addr_);
+    }
+
+    // Runs when the awaiting coroutine is destroyed mid-probe, which withdraws the probe
+    ~ProbeAwaiter() {
+      if (port_) {
+        reactor_.pending_.erase(*port_);
+      }
+      if (queued_) {
+        std::erase(reactor_.ready_, this);
+      }
+    }
+
+    ProbeAwaiter(const ProbeAwaiter&) = delete;
+    ProbeAwaiter& operator=(const ProbeAwaiter&) = delete;
+
+    bool await_ready() const noexcept { return stop_.stop_requested(); }
+
+    void await_suspend(std::coroutine_handle<> waiting) {
+      int port = reactor_.allocate_port();
+      reactor_.transport_->send(dest_ip_, port, ttl_, payload_);
+      sent_ = Clock::now();
+      waiting_ = waiting;
+      reactor_.pending_.emplace(port, this);
+      port_ = port;
+    }
+
+    HopResult await_resume() { return std::move(result_); }
+
+   private:
+    friend class Reactor;
+
+    Reactor& reactor_;
+    std::string dest_ip_;
+    uint32_t dest_addr_ = 0;
+    int ttl_;
+    std::string payload_;
+    Clock::time_point deadline_;
+    std::stop_token stop_;
+    Clock::time_point sent_;
+    std::coroutine_handle<> waiting_;
+    std::optional<int> port_;
+    bool queued_ = false;
+    HopResult result_ = HopResult::timed_out_hop();
+  };
+
+  explicit Reactor(std::unique_ptr<ProbeTransport> transport) : transport_(std::move(transport)) {}
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  // Each probe gets a destination port no other pending probe uses, and a reply must also quote the
+  // probe's destination address, so concurrent traces never mix up their replies
+  ProbeAwaiter probe(std::string dest_ip, int ttl, std::string payload, Clock::time_point deadline,
+                     std::stop_token stop = {}) {
+    return ProbeAwaiter(*this, std::move(dest_ip), ttl, std::move(payload), deadline, std::move(stop));
+  }
+
+  // Starts a task that the reactor owns until it finishes. An exception escaping it is rethrown from
+  // run_once.
+  void spawn(Task<> task) {
+    tasks_.push_back(std::move(task));
+    tasks_.back().start();
+  }
+
+  // Handles whatever replies and timeouts are due, waiting at most `max_wait` for them. Returns whether
+  // probes are still in flight. Without any, it returns straight away: tasks still running are waiting on
+  // something other than this reactor, which an application driving run_once from its own loop can allow.
+  bool run_once(std::chrono::milliseconds max_wait = std::chrono::milliseconds(100)) {
+    if (!pending_.empty()) {
+      auto now = Clock::now();
+      auto wait = max_wait;
+      for (const auto& [port, probe] : pending_) {
+        auto until_deadline = std::chrono::ceil<std::chrono::milliseconds>(probe->deadline_ - now);
+        wait = std::clamp(until_deadline, std::chrono::milliseconds(0), wait);
+      }
+      transport_->wait(wait);
+    }
+
+    while (auto response = transport_->receive()) {
+      if (!response->icmp) {
+        continue;
+      }
+      auto it = pending_.find(response->icmp->original_dest_port);
+      if (it == pending_.end() || it->second->dest_addr_ != response->icmp->original_dest_addr) {
+        continue;
+      }
+
+      ProbeAwaiter& probe = *it->second;
+      double rtt_ms = std::chrono::duration<double, std::milli>(Clock::now() - probe.sent_).count();
+      probe.result_ = response->icmp->type == IcmpType::DestUnreachable
+                          ? HopResult::reached(std::move(response->sender_ip), rtt_ms, response->icmp->ttl)
+                          : HopResult::transit(std::move(response->sender_ip), rtt_ms, response->icmp->ttl);
+      complete(it);
+    }
+
+    auto now = Clock::now();
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      auto current = it++;
+      if (current->second->deadline_ <= now || current->second->stop_.stop_requested()) {
+        complete(current);
+      }
+    }
+
+    // Resuming one coroutine may destroy another whose probe also completed, which takes it off the queue
+    while (!ready_.empty()) {
+      ProbeAwaiter* probe = ready_.front();
+      ready_.pop_front();
+      probe->queued_ = false;
+      probe->waiting_.resume();
+    }
+
+    for (auto it = tasks_.begin(); it != tasks_.end();) {
+      if (!it->done()) {
+        ++it;
+        continue;
+      }
+      Task<> finished = std::move(*it);
+      it = tasks_.erase(it);
+      finished.result();
+    }
+
+    return !pending_.empty();
+  }
+
+  // Runs until every spawned task has finished. Throws if tasks are left waiting with no probe in flight,
+  // e.g. on a stream that was destroyed, since nothing on this thread could ever resume them.
+  void run() {
+    while (run_once()) {
+    }
+    if (!tasks_.empty()) {
+      throw std::runtime_error(std::to_string(tasks_.size()) + " task(s) waiting with no probe in flight");
+    }
+  }
+
+  std::size_t pending_probes() const { return pending_.size(); }
+  std::size_t running_tasks() const { return tasks_.size(); }
+
+ private:
+  static constexpr int kFirstPort = 33434;
+  static constexpr int kLastPort = 65535;
+
+  int allocate_port() {
+    for (int attempt = kFirstPort; attempt <= kLastPort; ++attempt) {
+      int port = next_port_;
+      next_port_ = next_port_ == kLastPort ? kFirstPort : next_port_ + 1;
+      if (!pending_.contains(port)) {
+        return port;
+      }
+    }
+    throw std::runtime_error("No free probe port");
+  }
+
+  void complete(std::unordered_map<int, ProbeAwaiter*>::iterator it) {
+    ProbeAwaiter* probe = it->second;
+    pending_.erase(it);
+    probe->port_.reset();
+    probe->queued_ = true;
+    ready_.push_back(probe);
+  }
+
+  std::unique_ptr<ProbeTransport> transport_;
+  std::unordered_map<int, ProbeAwaiter*> pending_;
+  std::deque<ProbeAwaiter*> ready_;
+  // Declared last so that tasks, and the probes they are awaiting, go away before the queues they are in
+  std::vector<Task<>> tasks_;
+  int next_port_ = kFirstPort;
+};
+
+struct TraceOptions {
+  int max_hops = 64;
+  int tries_per_hop = 3;
+  std::chrono::milliseconds timeout{100};
+  std::string message = "codingchallenges.fyi trace route";
+  // The trace ends early, after its current probe, once the deadline passes or stop is requested
+  std::optional<Reactor::Clock::time_point> deadline;
+  std::stop_token stop;
+};
+
+// Traces `dest_ip` on `reactor`, yielding each hop as soon as its probes are done. Hops are probed
+// and averaged exactly as TraceRoute does, minus the output.
+inline HopStream trace(Reactor& reactor, std::string dest_ip, TraceOptions options) {
+  auto finished = [&] {
+    return options.stop.stop_requested() || (options.deadline && Reactor::Clock::now() >= *options.deadline);
+  };
+
+  for (int ttl = 1; ttl <= options.max_hops; ++ttl) {
+    // Every hop yielded was probed at least once; a TTL the trace never got to is not reported as silent
+    if (finished()) {
+      co_return;
+    }
+
+    HopAccumulator hop;
+    for (int t = 0; t < options.tries_per_hop && !finished(); ++t) {
+      auto deadline = Reactor::Clock::now() + options.timeout;
+      if (options.deadline) {
+        deadline = std::min(deadline, *options.deadline);
+      }
+      hop.add(co_await reactor.probe(dest_ip, ttl, options.message, deadline, options.stop));
+    }
+
+    TraceHop next{.ttl = ttl, .hop = hop.result()};
+    bool reached = next.hop.reached_destination;
+    co_yield std::move(next);
+
+    if (reached) {
+      co_return;
+    }
+  }
+}
@@ -3,11 +3,36 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <expected>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
+// The dotted-quad form of `host` if it is an IPv4 literal, so it can skip the resolver entirely
+inline std::optional<std::string> parse_ip_literal(std::string_view host) {
+  std::string host_str(host);
+  struct in_addr addr{};
+  if (inet_pton(AF_INET, host_str.c_str(), &addr) != 1) {
+    return std::nullopt;
+  }
+  char ip[INET_ADDRSTRLEN]{};
+  inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+  return std::string(ip);
+}
+
+// Implementations must be safe to call from several threads at once, see BatchResolver
 class DnsResolver {
  public:
   virtual ~DnsResolver() = default;
@@ -18,12 +43,17 @@ class DnsResolver {
 class SystemDnsResolver : public DnsResolver {
  public:
   std::string resolve(std::string_view hostname) override final {
+    if (auto literal = parse_ip_literal(hostname)) {
+      return *literal;
+    }
+
     struct addrinfo hints{};
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_DGRAM;
 
+    std::string hostname_str(hostname);
     struct addrinfo* result = nullptr;
-    int status = getaddrinfo(hostname.data(), nullptr, &hints, &result);
+    int status = getaddrinfo(hostname_str.c_str(), nullptr, &hints, &result);
     if (status != 0) {
       throw std::runtime_error(std::string("Failed to resolve hostname: ") + gai_strerror(status));
     }
@@ -39,7 +69,8 @@ class SystemDnsResolver : public DnsResolver {
   std::string reverse_resolve(std::string_view ip) override final {
     struct sockaddr_in sa{};
     sa.sin_family = AF_INET;
-    inet_pton(AF_INET, ip.data(), &sa.sin_addr);
+    std::string ip_str(ip);
+    inet_pton(AF_INET, ip_str.c_str(), &sa.sin_addr);
 
     char host[NI_MAXHOST]{};
     int status = getnameinfo(reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa), host, sizeof(host), nullptr, 0, 0);
@@ -50,3 +81,116 @@ class SystemDnsResolver : public DnsResolver {
     return std::string(host);
   }
 };
+
+// Never touches the network, so replaying a capture gives the same output wherever it runs. Hostnames
+// resolve to the one destination the capture was recorded for, and hop addresses are printed as is.
+class OfflineDnsResolver : public DnsResolver {
+ public:
+  explicit OfflineDnsResolver(std::vector<std::string> recorded_destinations)
+      : recorded_destinations_(std::move(recorded_destinations)) {}
+
+  std::string resolve(std::string_view hostname) override final {
+    if (auto literal = parse_ip_literal(hostname)) {
+      return *literal;
+    }
+    if (recorded_destinations_.size() != 1) {
+      throw std::runtime_error("Capture has probes to " + std::to_string(recorded_destinations_.size()) +
+                               " destinations, give the address to replay instead of a hostname");
+    }
+    return recorded_destinations_.front();
+  }
+
+  std::string reverse_resolve(std::string_view ip) override final { return std::string(ip); }
+
+ private:
+  std::vector<std::string> recorded_destinations_;
+};
+
+// Resolves a list of targets with a bounded number of lookups in flight. IP literals are reported as
+// soon as the lookups have started, and each distinct hostname is looked up once no matter how often it
+// appears. Results are handed to the callback on the calling thread as soon as they arrive, so the caller
+// can start working on resolved targets while slower lookups are still pending.
+class BatchResolver {
+ public:
+  using Result = std::expected<std::string, std::string>;
+  using Callback = std::function<void(const std::string& target, const Result& ip)>;
+
+  explicit BatchResolver(DnsResolver& resolver, std::size_t max_in_flight = 16)
+      : resolver_(resolver), max_in_flight_(std::max<std::size_t>(max_in_flight, 1)) {}
+
+  void resolve_all(const std::vector<std::string>& targets, const Callback& on_resolved) {
+    std::vector<std::pair<std::string, std::string>> literals;
+    std::map<std::string, int> pending;
+    for (const auto& target : targets) {
+      if (auto literal = parse_ip_literal(target)) {
+        literals.emplace_back(target, std::move(*literal));
+      } else {
+        ++pending[target];
+      }
+    }
+
+    std::vector<std::string> hostnames;
+    for (const auto& [hostname, count] : pending) {
+      hostnames.push_back(hostname);
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::queue<std::pair<std::string, Result>> results;
+    std::size_t next = 0;
+
+    auto worker = [&](std::stop_token stop) {
+      while (!stop.stop_requested()) {
+        std::string hostname;
+        {
+          std::lock_guard lock(mutex);
+          if (next == hostnames.size()) {
+            return;
+          }
+          hostname = hostnames[next++];
+        }
+
+        Result ip;
+        try {
+          ip = resolver_.resolve(hostname);
+        } catch (const std::exception& e) {
+          ip = std::unexpected(std::string(e.what()));
+        }
+
+        {
+          std::lock_guard lock(mutex);
+          results.emplace(std::move(hostname), std::move(ip));
+        }
+        ready.notify_one();
+      }
+    };
+
+    // Declared after everything the workers touch, so they are stopped and joined first on every exit path
+    std::vector<std::jthread> workers;
+    for (std::size_t i = 0; i < std::min(max_in_flight_, hostnames.size()); ++i) {
+      workers.emplace_back(worker);
+    }
+
+    // Literals are handed over only once the lookups are under way, so they overlap with whatever the
+    // caller does with the literals
+    for (const auto& [target, ip] : literals) {
+      on_resolved(target, ip);
+    }
+
+    for (std::size_t delivered = 0; delivered < hostnames.size(); ++delivered) {
+      std::unique_lock lock(mutex);
+      ready.wait(lock, [&] { return !results.empty(); });
+      auto [hostname, ip] = std::move(results.front());
+      results.pop();
+      lock.unlock();
+
+      for (int i = 0; i < pending[hostname]; ++i) {
+        on_resolved(hostname, ip);
+      }
+    }
+  }
+
+ private:
+  DnsResolver& resolver_;
+  std::size_t max_in_flight_;
+};
@@ -17,6 +17,10 @@ enum class IcmpType : uint8_t {
 struct IcmpPacket {
   IcmpType type;
   uint16_t original_dest_port;
+  uint8_t ttl;  // Remaining TTL of the reply itself, used to estimate how far away its sender is
+  // Where the original probe was going and which port it came from; the address is in network byte order
+  uint32_t original_dest_addr;
+  uint16_t original_source_port;
 };
 
 inline std::optional<IcmpPacket> parse_icmp(std::span<const uint8_t> raw_packet) {
@@ -58,5 +62,9 @@ inline std::optional<IcmpPacket> parse_icmp(std::span<const uint8_t> raw_packet)
 
   const auto& udp = *reinterpret_cast<const struct udphdr*>(raw_packet.data() + inner_ip_offset + inner_ip_len);
 
-  return IcmpPacket{static_cast<IcmpType>(icmp.type), ntohs(udp.dest)};
+  return IcmpPacket{.type = static_cast<IcmpType>(icmp.type),
+                    .original_dest_port = ntohs(udp.dest),
+                    .ttl = outer_ip.ttl,
+                    .original_dest_addr = inner_ip.daddr,
+                    .original_source_port = ntohs(udp.source)};
 }
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "prober.hpp"
+
+struct PathChange {
+  int ttl;
+  std::string previous;  // Empty when the path used to be shorter
+  std::string current;   // Empty when the path got shorter
+};
+
+inline void print_path_change(std::ostream& out, const PathChange& change) {
+  out << " " << change.ttl << "  " << (change.previous.empty() ? "-" : change.previous) << " -> "
+      << (change.current.empty() ? "-" : change.current) << std::endl;
+}
+
+// Watches the paths to a set of destinations across repeated checks. The first check of a destination
+// traces it hop by hop; later checks only probe the destination's TTL, the TTL just before it and a few
+// TTLs sampled along the path, and fall back to a full trace only when one of those responders differs
+// from the last known path or the destination stops answering. A stable path then costs a handful of
+// probes per cycle instead of one per hop.
+class PathMonitor {
+ public:
+  PathMonitor(int max_hops, int tries_per_hop, std::string_view message, std::unique_ptr<Prober> prober,
+              int sampled_hops = 3)
+      : max_hops_(max_hops),
+        tries_per_hop_(tries_per_hop),
+        sampled_hops_(sampled_hops),
+        message_(message),
+        prober_(std::move(prober)) {}
+
+  std::vector<PathChange> check(const std::string& dest_ip) {
+    auto it = paths_.find(dest_ip);
+    if (it != paths_.end() && !sampled_hops_differ(dest_ip, it->second)) {
+      return {};
+    }
+
+    std::vector<HopResult> path = trace(dest_ip);
+    static const std::vector<HopResult> no_path;
+    auto changes = diff(it == paths_.end() ? no_path : it->second, path);
+    paths_[dest_ip] = std::move(path);
+    return changes;
+  }
+
+  const std::vector<HopResult>* known_path(const std::string& dest_ip) const {
+    auto it = paths_.find(dest_ip);
+    return it == paths_.end() ? nullptr : &it->second;
+  }
+
+ private:
+  HopResult probe(const std::string& dest_ip, int ttl, int tries) {
+    return probe_hop(*prober_, dest_ip, probe_port(ttl, tries_per_hop_), ttl, tries, message_);
+  }
+
+  std::vector<HopResult> trace(const std::string& dest_ip) {
+    std::vector<HopResult> path;
+    for (int ttl = 1; ttl <= max_hops_; ++ttl) {
+      path.push_back(probe(dest_ip, ttl, tries_per_hop_));
+      if (path.back().reached_destination) {
+        break;
+      }
+    }
+    // A path that goes silent before the destination ends at its last responder
+    while (!path.empty() && path.back().timed_out) {
+      path.pop_back();
+    }
+    return path;
+  }
+
+  // Each sampled TTL gets a single probe; there is no RTT to average, only a responder to compare. A
+  // silent intermediate hop is not taken as a change: routers routinely rate-limit ICMP, and a silent hop
+  // says nothing about whether the path moved. A silent destination is, once all its tries go unanswered,
+  // as is an answer past the end of a path that used to go silent.
+  bool sampled_hops_differ(const std::string& dest_ip, const std::vector<HopResult>& known) {
+    const int length = static_cast<int>(known.size());
+    std::set<int> ttls{length, length - 1};
+    for (int k = 1; k <= sampled_hops_; ++k) {
+      ttls.insert(k * length / (sampled_hops_ + 1));
+    }
+    if (length < max_hops_ && (length == 0 || !known.back().reached_destination)) {
+      ttls.insert(length + 1);
+    }
+
+    for (int ttl : ttls) {
+      if (ttl < 1) {
+        continue;
+      }
+      if (ttl > length) {
+        if (!probe(dest_ip, ttl, 1).timed_out) {
+          return true;
+        }
+        continue;
+      }
+
+      const HopResult& expected = known[ttl - 1];
+      HopResult hop = probe(dest_ip, ttl, 1);
+      for (int t = 1; hop.timed_out && expected.reached_destination && t < tries_per_hop_; ++t) {
+        hop = probe(dest_ip, ttl, 1);
+      }
+      if (hop.timed_out) {
+        if (expected.reached_destination) {
+          return true;
+        }
+        continue;
+      }
+      if (hop.reached_destination != expected.reached_destination ||
+          (!expected.timed_out && hop.sender_ip != expected.sender_ip)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static std::vector<PathChange> diff(const std::vector<HopResult>& previous, const std::vector<HopResult>& current) {
+    std::vector<PathChange> changes;
+    const std::size_t length = std::max(previous.size(), current.size());
+    for (std::size_t i = 0; i < length; ++i) {
+      std::string before = i < previous.size() ? previous[i].sender_ip : "";
+      std::string after = i < current.size() ? current[i].sender_ip : "";
+      if (before != after) {
+        changes.push_back(
+            {.ttl = static_cast<int>(i) + 1, .previous = std::move(before), .current = std::move(after)});
+      }
+    }
+    return changes;
+  }
+
+  int max_hops_;
+  int tries_per_hop_;
+  int sampled_hops_;
+  std::string message_;
+  std::unique_ptr<Prober> prober_;
+  std::map<std::string, std::vector<HopResult>> paths_;
+};
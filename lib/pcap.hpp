@@ -0,0 +1,191 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Classic pcap format with nanosecond timestamps. LINKTYPE_RAW means every record starts with the IPv4
+// header, which matches both what the raw ICMP socket hands us and the probes we synthesize below.
+constexpr uint32_t kPcapMagicMicros = 0xa1b2c3d4;
+constexpr uint32_t kPcapMagicNanos = 0xa1b23c4d;
+constexpr uint32_t kPcapLinkTypeRaw = 101;
+constexpr uint32_t kPcapSnapLen = 65535;
+
+struct PcapFileHeader {
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int32_t thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t linktype;
+};
+
+struct PcapRecordHeader {
+  uint32_t ts_sec;
+  uint32_t ts_frac;
+  uint32_t incl_len;
+  uint32_t orig_len;
+};
+
+struct PcapRecord {
+  std::chrono::nanoseconds timestamp;
+  std::span<const uint8_t> data;
+};
+
+// Builds the IPv4 + UDP packet a probe puts on the wire. The source address and port are picked by the
+// kernel and unknown to us, so they are left zeroed; replay only needs the destination, port and TTL.
+inline std::vector<uint8_t> make_probe_packet(std::string_view dest_ip, int port, int ttl, std::string_view payload) {
+  std::vector<uint8_t> packet(sizeof(struct iphdr) + sizeof(struct udphdr) + payload.size(), 0);
+
+  auto* ip = reinterpret_cast<struct iphdr*>(packet.data());
+  ip->version = 4;
+  ip->ihl = 5;
+  ip->ttl = static_cast<uint8_t>(ttl);
+  ip->protocol = IPPROTO_UDP;
+  ip->tot_len = htons(static_cast<uint16_t>(packet.size()));
+  std::string dest_str(dest_ip);
+  inet_pton(AF_INET, dest_str.c_str(), &ip->daddr);
+
+  auto* udp = reinterpret_cast<struct udphdr*>(packet.data() + sizeof(struct iphdr));
+  udp->dest = htons(static_cast<uint16_t>(port));
+  udp->len = htons(static_cast<uint16_t>(sizeof(struct udphdr) + payload.size()));
+
+  std::memcpy(packet.data() + sizeof(struct iphdr) + sizeof(struct udphdr), payload.data(), payload.size());
+  return packet;
+}
+
+class PcapWriter {
+ public:
+  explicit PcapWriter(const std::string& path) : out_(path, std::ios::binary | std::ios::trunc) {
+    if (!out_) {
+      throw std::runtime_error("Failed to open capture file: " + path);
+    }
+    buffer_.reserve(kBufferSize);
+
+    PcapFileHeader header{.magic = kPcapMagicNanos,
+                          .version_major = 2,
+                          .version_minor = 4,
+                          .thiszone = 0,
+                          .sigfigs = 0,
+                          .snaplen = kPcapSnapLen,
+                          .linktype = kPcapLinkTypeRaw};
+    append(&header, sizeof(header));
+  }
+
+  ~PcapWriter() {
+    try {
+      flush();
+    } catch (...) {
+    }
+  }
+
+  PcapWriter(const PcapWriter&) = delete;
+  PcapWriter& operator=(const PcapWriter&) = delete;
+
+  void write(std::span<const uint8_t> packet,
+             std::chrono::system_clock::time_point when = std::chrono::system_clock::now()) {
+    const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch());
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+    const auto length = static_cast<uint32_t>(std::min<std::size_t>(packet.size(), kPcapSnapLen));
+
+    PcapRecordHeader header{.ts_sec = static_cast<uint32_t>(seconds.count()),
+                            .ts_frac = static_cast<uint32_t>((since_epoch - seconds).count()),
+                            .incl_len = length,
+                            .orig_len = static_cast<uint32_t>(packet.size())};
+    append(&header, sizeof(header));
+    append(packet.data(), length);
+
+    if (buffer_.size() >= kBufferSize) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (buffer_.empty()) {
+      return;
+    }
+    out_.write(reinterpret_cast<const char*>(buffer_.data()), static_cast<std::streamsize>(buffer_.size()));
+    out_.flush();
+    buffer_.clear();
+    if (!out_) {
+      throw std::runtime_error("Failed to write capture file");
+    }
+  }
+
+ private:
+  static constexpr std::size_t kBufferSize = 64 * 1024;
+
+  void append(const void* data, std::size_t size) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+  }
+
+  std::ofstream out_;
+  std::vector<uint8_t> buffer_;
+};
+
+// Loads a whole capture into memory and hands out records as views into that buffer, so iterating a
+// capture costs no allocation per packet. Records stay valid for the lifetime of the reader.
+class PcapReader {
+ public:
+  explicit PcapReader(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      throw std::runtime_error("Failed to open capture file: " + path);
+    }
+    data_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    if (data_.size() < sizeof(PcapFileHeader)) {
+      throw std::runtime_error("Capture file too short: " + path);
+    }
+    PcapFileHeader header{};
+    std::memcpy(&header, data_.data(), sizeof(header));
+    if (header.magic != kPcapMagicNanos && header.magic != kPcapMagicMicros) {
+      throw std::runtime_error("Unsupported capture format: " + path);
+    }
+    if (header.linktype != kPcapLinkTypeRaw) {
+      throw std::runtime_error("Unsupported capture link type: " + path);
+    }
+    nanosecond_timestamps_ = header.magic == kPcapMagicNanos;
+    offset_ = sizeof(header);
+  }
+
+  std::optional<PcapRecord> next() {
+    if (data_.size() - offset_ < sizeof(PcapRecordHeader)) {
+      return std::nullopt;
+    }
+    PcapRecordHeader header{};
+    std::memcpy(&header, data_.data() + offset_, sizeof(header));
+    offset_ += sizeof(header);
+
+    if (data_.size() - offset_ < header.incl_len) {
+      throw std::runtime_error("Truncated capture record");
+    }
+    std::span<const uint8_t> packet(data_.data() + offset_, header.incl_len);
+    offset_ += header.incl_len;
+
+    auto timestamp = std::chrono::seconds(header.ts_sec) +
+                     (nanosecond_timestamps_ ? std::chrono::nanoseconds(header.ts_frac)
+                                             : std::chrono::nanoseconds(std::chrono::microseconds(header.ts_frac)));
+    return PcapRecord{.timestamp = timestamp, .data = packet};
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  std::size_t offset_ = 0;
+  bool nanosecond_timestamps_ = true;
+};
@@ -4,27 +4,37 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <chrono>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <vector>
 
+#include "asn.hpp"
 #include "icmp.hpp"
+#include "pcap.hpp"
 
 struct HopResult {
   std::string sender_ip;
   bool reached_destination = false;
   bool timed_out = false;
+  bool inferred = false;  // Taken from an earlier trace instead of probed, so there is no RTT
   double rtt_ms = 0.0;
+  int reply_ttl = 0;  // IP TTL left on the reply, 0 when unknown
+  std::optional<AsnInfo> asn = std::nullopt;
 
   static HopResult timed_out_hop() { return {.sender_ip = "*", .timed_out = true}; }
 
-  static HopResult reached(std::string ip, double rtt) {
-    return {.sender_ip = std::move(ip), .reached_destination = true, .rtt_ms = rtt};
+  static HopResult reached(std::string ip, double rtt, int reply_ttl = 0) {
+    return {.sender_ip = std::move(ip), .reached_destination = true, .rtt_ms = rtt, .reply_ttl = reply_ttl};
   }
 
-  static HopResult transit(std::string ip, double rtt) { return {.sender_ip = std::move(ip), .rtt_ms = rtt}; }
+  static HopResult transit(std::string ip, double rtt, int reply_ttl = 0) {
+    return {.sender_ip = std::move(ip), .rtt_ms = rtt, .reply_ttl = reply_ttl};
+  }
 };
 
 class Prober {
@@ -33,6 +43,60 @@ class Prober {
   virtual HopResult send_probe(std::string_view dest_ip, int port, int ttl, std::string_view payload) = 0;
 };
 
+// Each TTL gets its own block of destination ports, one per try, so replies can be told apart
+inline int probe_port(int ttl, int tries_per_hop) {
+  constexpr int start_port = 33434;
+  return start_port + (ttl - 1) * tries_per_hop;
+}
+
+// Combines the probes sent at one TTL: the RTT is averaged over the answered ones
+class HopAccumulator {
+ public:
+  void add(HopResult result) {
+    if (result.timed_out) {
+      return;
+    }
+
+    total_rtt_ += result.rtt_ms;
+    ++success_count_;
+    if (sender_ip_.empty()) {
+      sender_ip_ = std::move(result.sender_ip);
+      reply_ttl_ = result.reply_ttl;
+    }
+    if (result.reached_destination) {
+      reached_ = true;
+    }
+  }
+
+  HopResult result() {
+    if (success_count_ == 0) {
+      return HopResult::timed_out_hop();
+    }
+    double avg_rtt = total_rtt_ / success_count_;
+    if (reached_) {
+      return HopResult::reached(std::move(sender_ip_), avg_rtt, reply_ttl_);
+    }
+    return HopResult::transit(std::move(sender_ip_), avg_rtt, reply_ttl_);
+  }
+
+ private:
+  double total_rtt_ = 0.0;
+  int success_count_ = 0;
+  std::string sender_ip_;
+  int reply_ttl_ = 0;
+  bool reached_ = false;
+};
+
+// Sends `tries` probes at one TTL and averages the RTT of those that were answered
+inline HopResult probe_hop(Prober& prober, std::string_view dest_ip, int base_port, int ttl, int tries,
+                           std::string_view payload) {
+  HopAccumulator hop;
+  for (int t = 0; t < tries; ++t) {
+    hop.add(prober.send_probe(dest_ip, base_port + t, ttl, payload));
+  }
+  return hop.result();
+}
+
 class UdpSender {
  public:
   explicit UdpSender(int ttl) {
@@ -51,6 +115,24 @@ class UdpSender {
   UdpSender(const UdpSender&) = delete;
   UdpSender& operator=(const UdpSender&) = delete;
 
+  void set_ttl(int ttl) {
+    if (setsockopt(fd_, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
+      throw std::runtime_error("Failed to set TTL");
+    }
+  }
+
+  // Binds to an ephemeral port now rather than on the first send, so the port is known up front
+  uint16_t bind_local_port() {
+    struct sockaddr_in local_addr{};
+    local_addr.sin_family = AF_INET;
+    socklen_t local_len = sizeof(local_addr);
+    if (bind(fd_, reinterpret_cast<struct sockaddr*>(&local_addr), sizeof(local_addr)) < 0 ||
+        getsockname(fd_, reinterpret_cast<struct sockaddr*>(&local_addr), &local_len) < 0) {
+      throw std::runtime_error("Failed to bind UDP socket");
+    }
+    return ntohs(local_addr.sin_port);
+  }
+
   void send(std::string_view dest_ip, int port, std::string_view payload) {
     struct sockaddr_in dest_addr{};
     dest_addr.sin_family = AF_INET;
@@ -76,7 +158,7 @@ struct IcmpResponse {
 
 class IcmpReceiver {
  public:
-  explicit IcmpReceiver(std::chrono::milliseconds timeout) {
+  explicit IcmpReceiver(std::chrono::milliseconds timeout, PcapWriter* capture = nullptr) : capture_(capture) {
     fd_ = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
     if (fd_ < 0) {
       throw std::runtime_error("Failed to create ICMP socket (need root/CAP_NET_RAW)");
@@ -108,27 +190,38 @@ class IcmpReceiver {
       return std::nullopt;
     }
 
+    std::span<const uint8_t> packet(buffer.data(), static_cast<std::size_t>(bytes));
+    if (capture_) {
+      capture_->write(packet);
+    }
+
     char ip_str[INET_ADDRSTRLEN]{};
     inet_ntop(AF_INET, &from_addr.sin_addr, ip_str, sizeof(ip_str));
 
-    auto icmp = parse_icmp(std::span<const uint8_t>(buffer.data(), static_cast<std::size_t>(bytes)));
+    auto icmp = parse_icmp(packet);
     return IcmpResponse{.sender_ip = std::string(ip_str), .icmp = icmp};
   }
 
  private:
   int fd_;
+  PcapWriter* capture_;
 };
 
 class NetworkProber : public Prober {
  public:
-  explicit NetworkProber(std::chrono::milliseconds timeout) : timeout_(timeout) {}
+  // When a capture writer is given, every probe sent and every ICMP packet received is recorded to it.
+  explicit NetworkProber(std::chrono::milliseconds timeout, std::shared_ptr<PcapWriter> capture = nullptr)
+      : timeout_(timeout), capture_(std::move(capture)) {}
 
   HopResult send_probe(std::string_view dest_ip, int port, int ttl, std::string_view payload) override final {
-    IcmpReceiver receiver(timeout_);
+    IcmpReceiver receiver(timeout_, capture_.get());
     UdpSender sender(ttl);
 
     auto start = std::chrono::steady_clock::now();
     sender.send(dest_ip, port, payload);
+    if (capture_) {
+      capture_->write(make_probe_packet(dest_ip, port, ttl, payload));
+    }
 
     while (true) {
       auto response = receiver.receive();
@@ -144,12 +237,113 @@ class NetworkProber : public Prober {
       double rtt_ms = std::chrono::duration<double, std::milli>(end - start).count();
 
       if (response->icmp->type == IcmpType::DestUnreachable) {
-        return HopResult::reached(std::move(response->sender_ip), rtt_ms);
+        return HopResult::reached(std::move(response->sender_ip), rtt_ms, response->icmp->ttl);
       }
-      return HopResult::transit(std::move(response->sender_ip), rtt_ms);
+      return HopResult::transit(std::move(response->sender_ip), rtt_ms, response->icmp->ttl);
     }
   }
 
  private:
   std::chrono::milliseconds timeout_;
+  std::shared_ptr<PcapWriter> capture_;
+};
+
+// Lets several users, e.g. one TraceRoute per target, send through one prober and share its state
+class SharedProber : public Prober {
+ public:
+  explicit SharedProber(std::shared_ptr<Prober> prober) : prober_(std::move(prober)) {}
+
+  HopResult send_probe(std::string_view dest_ip, int port, int ttl, std::string_view payload) override final {
+    return prober_->send_probe(dest_ip, port, ttl, payload);
+  }
+
+ private:
+  std::shared_ptr<Prober> prober_;
+};
+
+// Answers probes from a capture recorded by NetworkProber instead of the network. Each probe is matched
+// to the recorded probe with the same TTL and port, and the ICMP packets captured before the next probe
+// go through parse_icmp exactly as they did live. Replay never waits, so it runs faster than real time.
+class ReplayProber : public Prober {
+ public:
+  explicit ReplayProber(const std::string& path) : reader_(path) {
+    while (auto record = reader_.next()) {
+      if (record->data.size() < sizeof(struct iphdr)) {
+        continue;
+      }
+      const auto& ip = *reinterpret_cast<const struct iphdr*>(record->data.data());
+      const std::size_t ip_len = ip.ihl * 4;
+
+      if (ip.protocol == IPPROTO_UDP && record->data.size() >= ip_len + sizeof(struct udphdr)) {
+        const auto& udp = *reinterpret_cast<const struct udphdr*>(record->data.data() + ip_len);
+        probes_.push_back({.dest_addr = ip.daddr,
+                           .port = ntohs(udp.dest),
+                           .ttl = ip.ttl,
+                           .sent = record->timestamp,
+                           .responses = {}});
+      } else if (ip.protocol == IPPROTO_ICMP && !probes_.empty()) {
+        probes_.back().responses.push_back(*record);
+      }
+    }
+  }
+
+  HopResult send_probe(std::string_view dest_ip, int port, int ttl, std::string_view /*payload*/) override final {
+    std::string dest_str(dest_ip);
+    uint32_t dest_addr = 0;
+    inet_pton(AF_INET, dest_str.c_str(), &dest_addr);
+
+    auto it = std::find_if(probes_.begin() + static_cast<std::ptrdiff_t>(next_probe_), probes_.end(),
+                           [&](const RecordedProbe& probe) {
+                             return probe.dest_addr == dest_addr && probe.port == port && probe.ttl == ttl;
+                           });
+    if (it == probes_.end()) {
+      throw std::runtime_error("Capture has no probe to " + dest_str + " with ttl " + std::to_string(ttl) +
+                               " and port " + std::to_string(port));
+    }
+    next_probe_ = static_cast<std::size_t>(it - probes_.begin()) + 1;
+
+    for (const auto& response : it->responses) {
+      auto icmp = parse_icmp(response.data);
+      if (!icmp || icmp->original_dest_port != static_cast<uint16_t>(port)) {
+        continue;
+      }
+
+      const auto& outer_ip = *reinterpret_cast<const struct iphdr*>(response.data.data());
+      char ip_str[INET_ADDRSTRLEN]{};
+      inet_ntop(AF_INET, &outer_ip.saddr, ip_str, sizeof(ip_str));
+      double rtt_ms = std::chrono::duration<double, std::milli>(response.timestamp - it->sent).count();
+
+      if (icmp->type == IcmpType::DestUnreachable) {
+        return HopResult::reached(ip_str, rtt_ms, icmp->ttl);
+      }
+      return HopResult::transit(ip_str, rtt_ms, icmp->ttl);
+    }
+    return HopResult::timed_out_hop();
+  }
+
+  // Every address the capture has probes to, in the order they were first probed
+  std::vector<std::string> destinations() const {
+    std::vector<std::string> result;
+    for (const auto& probe : probes_) {
+      char ip_str[INET_ADDRSTRLEN]{};
+      inet_ntop(AF_INET, &probe.dest_addr, ip_str, sizeof(ip_str));
+      if (std::find(result.begin(), result.end(), ip_str) == result.end()) {
+        result.emplace_back(ip_str);
+      }
+    }
+    return result;
+  }
+
+ private:
+  struct RecordedProbe {
+    uint32_t dest_addr;
+    uint16_t port;
+    uint8_t ttl;
+    std::chrono::nanoseconds sent;
+    std::vector<PcapRecord> responses;
+  };
+
+  PcapReader reader_;
+  std::vector<RecordedProbe> probes_;
+  std::size_t next_probe_ = 0;
 };
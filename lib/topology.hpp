@@ -0,0 +1,470 @@
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mmap.hpp"
+#include "prober.hpp"
+
+// Keeps many traces in memory at a few bytes per hop. Hop addresses are interned into dense ids and
+// paths are stored in a prefix trie rooted at the local host, so traces sharing their first hops share
+// those nodes. Every index is an intrusive list over flat arrays, which makes the snapshot file a plain
+// dump of those arrays. A loaded snapshot is queried in place from the mapping; its arrays are only
+// copied out by the first change to the store.
+class TopologyStore {
+ public:
+  using AddressId = uint32_t;
+  using NodeId = uint32_t;
+  using TraceId = uint32_t;
+
+  // Interned id of hops that did not answer
+  static constexpr AddressId kNoResponse = 0;
+
+  struct Link {
+    AddressId from;
+    AddressId to;
+
+    bool operator==(const Link&) const = default;
+    auto operator<=>(const Link&) const = default;
+  };
+
+  TopologyStore() {
+    addresses_.mutable_items().push_back(0);
+    first_node_by_address_.mutable_items().push_back(kNone);
+    nodes_.mutable_items().push_back({.parent = kNone,
+                                      .address = kNoResponse,
+                                      .depth = 0,
+                                      .first_child = kNone,
+                                      .next_sibling = kNone,
+                                      .next_same_address = kNone,
+                                      .next_same_depth = kNone,
+                                      .first_trace = kNone});
+    first_node_by_depth_.mutable_items().push_back(kRoot);
+  }
+
+  TraceId add_trace(std::string_view destination_ip, std::span<const HopResult> hops) {
+    NodeId node = kRoot;
+    for (const auto& hop : hops) {
+      node = child(node, hop.timed_out ? kNoResponse : intern(hop.sender_ip));
+    }
+
+    AddressId destination = intern(destination_ip);
+    auto& traces = traces_.mutable_items();
+    auto& nodes = nodes_.mutable_items();
+    TraceId id = static_cast<TraceId>(traces.size());
+    traces.push_back({.destination = destination, .leaf = node, .next_same_leaf = nodes[node].first_trace});
+    nodes[node].first_trace = id;
+    return id;
+  }
+
+  AddressId intern(std::string_view ip) {
+    uint32_t addr = parse_address(ip);
+    if (auto id = find_address(addr)) {
+      return *id;
+    }
+
+    auto& addresses = addresses_.mutable_items();
+    AddressId id = static_cast<AddressId>(addresses.size());
+    addresses.push_back(addr);
+    first_node_by_address_.mutable_items().push_back(kNone);
+    address_ids_.emplace(addr, id);
+    return id;
+  }
+
+  std::optional<AddressId> find_address(std::string_view ip) const { return find_address(parse_address(ip)); }
+
+  std::string address(AddressId id) const {
+    if (id == kNoResponse) {
+      return "*";
+    }
+    char ip_str[INET_ADDRSTRLEN]{};
+    inet_ntop(AF_INET, &addresses_.at(id), ip_str, sizeof(ip_str));
+    return std::string(ip_str);
+  }
+
+  std::string destination(TraceId trace) const { return address(traces_.at(trace).destination); }
+
+  std::vector<std::string> path(TraceId trace) const {
+    std::vector<std::string> hops;
+    for (NodeId node = traces_.at(trace).leaf; node != kRoot; node = nodes_[node].parent) {
+      hops.push_back(address(nodes_[node].address));
+    }
+    std::reverse(hops.begin(), hops.end());
+    return hops;
+  }
+
+  // Every trace whose path goes through the given interface, in ascending order
+  std::vector<TraceId> traces_crossing(std::string_view ip) const {
+    std::vector<TraceId> result;
+    auto id = find_address(ip);
+    if (!id || *id == kNoResponse) {
+      return result;
+    }
+
+    // Nodes of one address can be nested (routing loops). A nested node is already in the subtree of the
+    // outermost one, so only those are walked, and the walk stays proportional to what it returns.
+    std::vector<NodeId> pending;
+    for (NodeId node = first_node_by_address_[*id]; node != kNone; node = nodes_[node].next_same_address) {
+      if (!has_ancestor_at(node, *id)) {
+        pending.push_back(node);
+      }
+    }
+    while (!pending.empty()) {
+      NodeId node = pending.back();
+      pending.pop_back();
+
+      for (TraceId trace = nodes_[node].first_trace; trace != kNone; trace = traces_[trace].next_same_leaf) {
+        result.push_back(trace);
+      }
+      for (NodeId c = nodes_[node].first_child; c != kNone; c = nodes_[c].next_sibling) {
+        pending.push_back(c);
+      }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  // Distinct links leaving hop `ttl`, i.e. between the responders at `ttl` and `ttl + 1`. Links with a
+  // non-responding end are skipped since their endpoints are unknown.
+  std::vector<Link> links_at_ttl(int ttl) const {
+    std::vector<Link> links;
+    if (ttl < 1 || static_cast<std::size_t>(ttl) >= first_node_by_depth_.size()) {
+      return links;
+    }
+
+    for (NodeId node = first_node_by_depth_[ttl]; node != kNone; node = nodes_[node].next_same_depth) {
+      if (nodes_[node].address == kNoResponse) {
+        continue;
+      }
+      for (NodeId c = nodes_[node].first_child; c != kNone; c = nodes_[c].next_sibling) {
+        if (nodes_[c].address != kNoResponse) {
+          links.push_back({.from = nodes_[node].address, .to = nodes_[c].address});
+        }
+      }
+    }
+
+    std::sort(links.begin(), links.end());
+    links.erase(std::unique(links.begin(), links.end()), links.end());
+    return links;
+  }
+
+  std::size_t trace_count() const { return traces_.size(); }
+  std::size_t address_count() const { return addresses_.size() - 1; }
+  std::size_t node_count() const { return nodes_.size() - 1; }
+
+  // The snapshot is the header followed by the raw address, address order, node, trace and depth arrays,
+  // in host byte order. It is only meant to be reloaded on the machine that wrote it. It is written next to
+  // `path` and renamed over it, since this store may still be reading from a mapping of that file.
+  void save(const std::string& path) const {
+    // Addresses sorted by value, so a loaded snapshot finds an address by binary search instead of hashing
+    std::vector<AddressId> address_order(addresses_.size() - 1);
+    std::iota(address_order.begin(), address_order.end(), AddressId{1});
+    std::sort(address_order.begin(), address_order.end(),
+              [&](AddressId a, AddressId b) { return addresses_[a] < addresses_[b]; });
+
+    const std::string temp_path = path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Failed to open topology snapshot: " + temp_path);
+    }
+
+    SnapshotHeader header{.magic = kSnapshotMagic,
+                          .address_count = static_cast<uint32_t>(addresses_.size()),
+                          .node_count = static_cast<uint32_t>(nodes_.size()),
+                          .trace_count = static_cast<uint32_t>(traces_.size()),
+                          .depth_count = static_cast<uint32_t>(first_node_by_depth_.size())};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_array(out, addresses_.items());
+    write_array(out, std::span<const AddressId>(address_order));
+    write_array(out, first_node_by_address_.items());
+    write_array(out, nodes_.items());
+    write_array(out, traces_.items());
+    write_array(out, first_node_by_depth_.items());
+
+    out.close();
+    if (!out) {
+      std::filesystem::remove(temp_path);
+      throw std::runtime_error("Failed to write topology snapshot: " + temp_path);
+    }
+    std::filesystem::rename(temp_path, path);
+  }
+
+  // Maps the snapshot and points the store's arrays into the mapping; nothing is copied or hashed. Every
+  // index is checked once against the counts, so a corrupt file is rejected here rather than read out of
+  // bounds by a later query.
+  static TopologyStore load(const std::string& path) {
+    auto file = std::make_shared<const MappedFile>(path);
+    auto bytes = file->bytes();
+
+    SnapshotHeader header{};
+    if (bytes.size() < sizeof(header)) {
+      throw std::runtime_error("Topology snapshot too short: " + path);
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != kSnapshotMagic) {
+      throw std::runtime_error("Not a topology snapshot: " + path);
+    }
+    if (header.address_count == 0 || header.node_count == 0 || header.depth_count == 0) {
+      throw std::runtime_error("Corrupt topology snapshot: " + path);
+    }
+
+    const std::size_t expected = sizeof(header) + std::size_t{header.address_count} * sizeof(uint32_t) * 3 -
+                                 sizeof(AddressId) + std::size_t{header.node_count} * sizeof(Node) +
+                                 std::size_t{header.trace_count} * sizeof(Trace) +
+                                 std::size_t{header.depth_count} * sizeof(NodeId);
+    if (bytes.size() != expected) {
+      throw std::runtime_error("Corrupt topology snapshot: " + path);
+    }
+
+    TopologyStore store;
+    std::size_t offset = sizeof(header);
+    store.addresses_ = FlatArray<uint32_t>(view_array<uint32_t>(bytes, offset, header.address_count));
+    store.address_order_ = view_array<AddressId>(bytes, offset, header.address_count - 1);
+    store.first_node_by_address_ = FlatArray<NodeId>(view_array<NodeId>(bytes, offset, header.address_count));
+    store.nodes_ = FlatArray<Node>(view_array<Node>(bytes, offset, header.node_count));
+    store.traces_ = FlatArray<Trace>(view_array<Trace>(bytes, offset, header.trace_count));
+    store.first_node_by_depth_ = FlatArray<NodeId>(view_array<NodeId>(bytes, offset, header.depth_count));
+    store.snapshot_ = std::move(file);
+
+    if (!store.is_consistent()) {
+      throw std::runtime_error("Corrupt topology snapshot: " + path);
+    }
+    return store;
+  }
+
+ private:
+  static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+  static constexpr NodeId kRoot = 0;
+  static constexpr uint64_t kSnapshotMagic = 0x3230504f544343ULL;  // "CCTOP02"
+
+  struct Node {
+    NodeId parent;
+    AddressId address;
+    uint32_t depth;
+    NodeId first_child;
+    NodeId next_sibling;
+    NodeId next_same_address;
+    NodeId next_same_depth;
+    TraceId first_trace;
+  };
+
+  struct Trace {
+    AddressId destination;
+    NodeId leaf;
+    TraceId next_same_leaf;
+  };
+
+  struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t address_count;
+    uint32_t node_count;
+    uint32_t trace_count;
+    uint32_t depth_count;
+  };
+
+  // An array that either views a loaded snapshot or is owned by the store. The view is copied out on the
+  // first call to mutable_items().
+  template <typename T>
+  class FlatArray {
+   public:
+    FlatArray() = default;
+    explicit FlatArray(std::span<const T> mapped) : mapped_(mapped), owned_(false) {}
+
+    std::span<const T> items() const { return owned_ ? std::span<const T>(items_) : mapped_; }
+    std::size_t size() const { return items().size(); }
+    const T& operator[](std::size_t i) const { return items()[i]; }
+
+    const T& at(std::size_t i) const {
+      if (i >= size()) {
+        throw std::out_of_range("TopologyStore index out of range: " + std::to_string(i));
+      }
+      return items()[i];
+    }
+
+    std::vector<T>& mutable_items() {
+      if (!owned_) {
+        items_.assign(mapped_.begin(), mapped_.end());
+        owned_ = true;
+      }
+      return items_;
+    }
+
+   private:
+    std::span<const T> mapped_;
+    std::vector<T> items_;
+    bool owned_ = true;
+  };
+
+  static uint32_t parse_address(std::string_view ip) {
+    std::string ip_str(ip);
+    uint32_t addr = 0;
+    if (inet_pton(AF_INET, ip_str.c_str(), &addr) != 1) {
+      throw std::invalid_argument("Not an IPv4 address: " + ip_str);
+    }
+    return addr;
+  }
+
+  // Addresses from a loaded snapshot are found by binary search over its sorted order, addresses
+  // interned since then by hash
+  std::optional<AddressId> find_address(uint32_t addr) const {
+    if (auto it = address_ids_.find(addr); it != address_ids_.end()) {
+      return it->second;
+    }
+    auto it = std::lower_bound(address_order_.begin(), address_order_.end(), addr,
+                               [&](AddressId id, uint32_t value) { return addresses_[id] < value; });
+    if (it != address_order_.end() && addresses_[*it] == addr) {
+      return *it;
+    }
+    return std::nullopt;
+  }
+
+  bool has_ancestor_at(NodeId node, AddressId address) const {
+    for (NodeId n = nodes_[node].parent; n != kRoot; n = nodes_[n].parent) {
+      if (nodes_[n].address == address) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Routers have few distinct next hops, so walking the sibling list is cheap and needs no separate index
+  NodeId child(NodeId parent, AddressId address) {
+    for (NodeId c = nodes_[parent].first_child; c != kNone; c = nodes_[c].next_sibling) {
+      if (nodes_[c].address == address) {
+        return c;
+      }
+    }
+
+    auto& nodes = nodes_.mutable_items();
+    auto& first_node_by_depth = first_node_by_depth_.mutable_items();
+    auto& first_node_by_address = first_node_by_address_.mutable_items();
+    NodeId id = static_cast<NodeId>(nodes.size());
+    uint32_t depth = nodes[parent].depth + 1;
+    if (depth == first_node_by_depth.size()) {
+      first_node_by_depth.push_back(kNone);
+    }
+    nodes.push_back({.parent = parent,
+                     .address = address,
+                     .depth = depth,
+                     .first_child = kNone,
+                     .next_sibling = nodes[parent].first_child,
+                     .next_same_address = first_node_by_address[address],
+                     .next_same_depth = first_node_by_depth[depth],
+                     .first_trace = kNone});
+    nodes[parent].first_child = id;
+    first_node_by_address[address] = id;
+    first_node_by_depth[depth] = id;
+    return id;
+  }
+
+  // Nodes and traces are only ever appended, and lists are built by prepending, so in a valid store every
+  // parent and list successor has a smaller id than the entry pointing to it. Checking that, along with
+  // what each list links by, also rules out cycles.
+  bool is_consistent() const {
+    const std::size_t address_count = addresses_.size();
+    const std::size_t node_count = nodes_.size();
+    const std::size_t trace_count = traces_.size();
+    const std::size_t depth_count = first_node_by_depth_.size();
+
+    for (std::size_t i = 0; i < address_order_.size(); ++i) {
+      if (address_order_[i] == kNoResponse || address_order_[i] >= address_count ||
+          (i > 0 && addresses_[address_order_[i - 1]] >= addresses_[address_order_[i]])) {
+        return false;
+      }
+    }
+    for (AddressId a = 0; a < address_count; ++a) {
+      NodeId first = first_node_by_address_[a];
+      if (first != kNone && (first >= node_count || nodes_[first].address != a)) {
+        return false;
+      }
+    }
+    for (uint32_t d = 0; d < depth_count; ++d) {
+      NodeId first = first_node_by_depth_[d];
+      if (first != kNone && (first >= node_count || nodes_[first].depth != d)) {
+        return false;
+      }
+    }
+
+    const Node& root = nodes_[kRoot];
+    if (root.parent != kNone || root.depth != 0 || root.next_sibling != kNone) {
+      return false;
+    }
+    for (NodeId id = 0; id < node_count; ++id) {
+      const Node& node = nodes_[id];
+      if (id != kRoot && (node.parent >= id || node.depth != nodes_[node.parent].depth + 1)) {
+        return false;
+      }
+      if (node.address >= address_count || node.depth >= depth_count) {
+        return false;
+      }
+      if (node.first_child != kNone &&
+          (node.first_child <= id || node.first_child >= node_count || nodes_[node.first_child].parent != id)) {
+        return false;
+      }
+      if (node.next_sibling != kNone && (node.next_sibling >= id || nodes_[node.next_sibling].parent != node.parent)) {
+        return false;
+      }
+      if (node.next_same_address != kNone &&
+          (node.next_same_address >= id || nodes_[node.next_same_address].address != node.address)) {
+        return false;
+      }
+      if (node.next_same_depth != kNone &&
+          (node.next_same_depth >= id || nodes_[node.next_same_depth].depth != node.depth)) {
+        return false;
+      }
+      if (node.first_trace != kNone && (node.first_trace >= trace_count || traces_[node.first_trace].leaf != id)) {
+        return false;
+      }
+    }
+
+    for (TraceId id = 0; id < trace_count; ++id) {
+      const Trace& trace = traces_[id];
+      if (trace.destination >= address_count || trace.leaf >= node_count) {
+        return false;
+      }
+      if (trace.next_same_leaf != kNone &&
+          (trace.next_same_leaf >= id || traces_[trace.next_same_leaf].leaf != trace.leaf)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename T>
+  static void write_array(std::ofstream& out, std::span<const T> items) {
+    out.write(reinterpret_cast<const char*>(items.data()), static_cast<std::streamsize>(items.size_bytes()));
+  }
+
+  template <typename T>
+  static std::span<const T> view_array(std::span<const uint8_t> bytes, std::size_t& offset, std::size_t count) {
+    std::span<const T> items(reinterpret_cast<const T*>(bytes.data() + offset), count);
+    offset += count * sizeof(T);
+    return items;
+  }
+
+  FlatArray<uint32_t> addresses_;
+  FlatArray<NodeId> first_node_by_address_;
+  FlatArray<Node> nodes_;
+  FlatArray<Trace> traces_;
+  FlatArray<NodeId> first_node_by_depth_;
+  std::span<const AddressId> address_order_;             // Sorted ids of the loaded snapshot's addresses
+  std::unordered_map<uint32_t, AddressId> address_ids_;  // Addresses interned since then
+  std::shared_ptr<const MappedFile> snapshot_;
+};
@@ -1,14 +1,66 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <iomanip>
+#include <map>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include "dns.hpp"
 #include "prober.hpp"
 
+struct TraceResult {
+  std::string destination_ip;
+  std::vector<HopResult> hops;
+};
+
+// Hosts send replies with one of a few well-known initial TTLs, and every router on the way back
+// decrements it. The smallest initial TTL at or above what arrived gives the number of hops to the sender.
+inline std::optional<int> estimate_hop_count(int reply_ttl) {
+  constexpr std::array<int, 4> initial_ttls{32, 64, 128, 255};
+  for (int initial : initial_ttls) {
+    if (reply_ttl > 0 && reply_ttl <= initial) {
+      return initial - reply_ttl + 1;
+    }
+  }
+  return std::nullopt;
+}
+
+// Remembers the paths traced from this host. Once a trace meets an interface at the same TTL as an
+// earlier trace did, the hops before it are assumed to be the same and need not be probed again.
+class LocalStopSet {
+ public:
+  void add(const std::vector<HopResult>& path) {
+    std::size_t index = paths_.size();
+    paths_.push_back(path);
+    for (std::size_t i = 0; i < path.size(); ++i) {
+      if (!path[i].timed_out) {
+        interfaces_.try_emplace(path[i].sender_ip, index, static_cast<int>(i) + 1);
+      }
+    }
+  }
+
+  // The known hops from TTL 1 up to and including `ip`, if `ip` was seen at `ttl` before
+  std::optional<std::vector<HopResult>> prefix_to(const std::string& ip, int ttl) const {
+    auto it = interfaces_.find(ip);
+    if (it == interfaces_.end() || it->second.second != ttl) {
+      return std::nullopt;
+    }
+    const auto& path = paths_[it->second.first];
+    return std::vector<HopResult>(path.begin(), path.begin() + ttl);
+  }
+
+ private:
+  std::vector<std::vector<HopResult>> paths_;
+  std::map<std::string, std::pair<std::size_t, int>> interfaces_;
+};
+
 class TraceRoute {
  public:
   TraceRoute(std::string_view hostname, int max_hops, int tries_per_hop, std::string_view message,
@@ -20,63 +72,115 @@ class TraceRoute {
         resolver_(std::move(resolver)),
         prober_(std::move(prober)) {}
 
-  void run(std::ostream& out) {
-    std::string resolved_ip = resolver_->resolve(hostname_);
-    out << "traceroute to " << hostname_ << " (" << resolved_ip << "), " << max_hops_ << " hops max, "
+  // Instead of walking up from TTL 1, send one probe to measure the distance to the destination, then
+  // probe forward and backward from the middle of the path. Backward probing stops at the first hop the
+  // stop set already knows, which can be shared between TraceRoute instances running from this host.
+  void enable_midpath_start(std::shared_ptr<LocalStopSet> stop_set) { stop_set_ = std::move(stop_set); }
+
+  // Tags every hop with the origin AS and prefix of its address, both in the output and in the result
+  void enable_asn_annotation(std::shared_ptr<const AsnTable> asn_table) { asn_table_ = std::move(asn_table); }
+
+  TraceResult run(std::ostream& out) { return run(out, resolver_->resolve(hostname_)); }
+
+  // Traces a destination whose address is already known, e.g. from a BatchResolver
+  TraceResult run(std::ostream& out, std::string destination_ip) {
+    TraceResult result{.destination_ip = std::move(destination_ip), .hops = {}};
+    out << "traceroute to " << hostname_ << " (" << result.destination_ip << "), " << max_hops_ << " hops max, "
         << message_.size() << " byte packets" << std::endl;
 
-    constexpr int start_port = 33434;
+    if (stop_set_) {
+      result.hops = trace_from_midpath(result.destination_ip);
+      for (std::size_t i = 0; i < result.hops.size(); ++i) {
+        annotate(result.hops[i]);
+        print_hop(out, static_cast<int>(i) + 1, result.hops[i]);
+      }
+      stop_set_->add(result.hops);
+      return result;
+    }
+
     for (int ttl = 1; ttl <= max_hops_; ++ttl) {
-      auto hop = probe_hop(resolved_ip, start_port + (ttl - 1) * tries_per_hop_, ttl);
+      auto hop = probe(result.destination_ip, ttl);
+      annotate(hop);
       print_hop(out, ttl, hop);
 
-      if (hop.reached_destination) {
+      result.hops.push_back(std::move(hop));
+      if (result.hops.back().reached_destination) {
         break;
       }
     }
+    return result;
   }
 
  private:
-  HopResult probe_hop(const std::string& dest_ip, int base_port, int ttl) {
-    double total_rtt = 0.0;
-    int success_count = 0;
-    std::string sender_ip;
-    bool reached = false;
+  HopResult probe(const std::string& dest_ip, int ttl) {
+    return probe_hop(*prober_, dest_ip, probe_port(ttl, tries_per_hop_), ttl, tries_per_hop_, message_);
+  }
 
-    for (int t = 0; t < tries_per_hop_; ++t) {
-      HopResult result = prober_->send_probe(dest_ip, base_port + t, ttl, message_);
+  std::vector<HopResult> trace_from_midpath(const std::string& dest_ip) {
+    // The distance probe goes out with the largest TTL and its own port block, so it reaches the destination
+    int start_ttl = 1;
+    HopResult distance_probe =
+        prober_->send_probe(dest_ip, probe_port(max_hops_ + 1, tries_per_hop_), max_hops_, message_);
+    if (distance_probe.reached_destination) {
+      if (auto hop_count = estimate_hop_count(distance_probe.reply_ttl)) {
+        start_ttl = std::clamp((*hop_count + 1) / 2, 1, max_hops_);
+      }
+    }
 
-      if (result.timed_out) {
-        continue;
+    std::vector<HopResult> hops(static_cast<std::size_t>(max_hops_));
+    int last_ttl = max_hops_;
+    for (int ttl = start_ttl; ttl <= max_hops_; ++ttl) {
+      hops[ttl - 1] = probe(dest_ip, ttl);
+      if (hops[ttl - 1].reached_destination) {
+        last_ttl = ttl;
+        break;
       }
+    }
 
-      total_rtt += result.rtt_ms;
-      ++success_count;
-      if (sender_ip.empty()) {
-        sender_ip = std::move(result.sender_ip);
+    for (int ttl = start_ttl - 1; ttl >= 1; --ttl) {
+      hops[ttl - 1] = probe(dest_ip, ttl);
+      if (hops[ttl - 1].reached_destination) {
+        // The estimate overshot and the destination is closer than the starting TTL
+        last_ttl = ttl;
+        continue;
       }
-      if (result.reached_destination) {
-        reached = true;
+      if (hops[ttl - 1].timed_out) {
+        continue;
+      }
+      if (auto prefix = stop_set_->prefix_to(hops[ttl - 1].sender_ip, ttl)) {
+        std::transform(prefix->begin(), prefix->end() - 1, hops.begin(), [](HopResult hop) {
+          hop.inferred = true;
+          hop.rtt_ms = 0.0;
+          return hop;
+        });
+        break;
       }
     }
 
-    if (success_count == 0) {
-      return HopResult::timed_out_hop();
-    }
-    double avg_rtt = total_rtt / success_count;
-    if (reached) {
-      return HopResult::reached(std::move(sender_ip), avg_rtt);
+    hops.resize(static_cast<std::size_t>(last_ttl));
+    return hops;
+  }
+
+  void annotate(HopResult& hop) {
+    if (asn_table_ && !hop.timed_out) {
+      hop.asn = asn_table_->lookup(hop.sender_ip);
     }
-    return HopResult::transit(std::move(sender_ip), avg_rtt);
   }
 
   void print_hop(std::ostream& out, int ttl, const HopResult& result) {
     if (result.timed_out) {
-      out << " " << ttl << "  *  * *" << std::endl;
+      out << " " << ttl << (result.inferred ? "  *  inferred" : "  *  * *") << std::endl;
     } else {
       std::string hostname = resolver_->reverse_resolve(result.sender_ip);
-      out << " " << ttl << "  " << hostname << " (" << result.sender_ip << ") " << std::fixed << std::setprecision(3)
-          << result.rtt_ms << " ms" << std::endl;
+      out << " " << ttl << "  " << hostname << " (" << result.sender_ip << ") ";
+      if (asn_table_) {
+        out << "[" << (result.asn ? "AS" + std::to_string(result.asn->asn) : "*") << "] ";
+      }
+      if (result.inferred) {
+        out << "inferred" << std::endl;
+      } else {
+        out << std::fixed << std::setprecision(3) << result.rtt_ms << " ms" << std::endl;
+      }
     }
   }
 
@@ -86,4 +190,6 @@ class TraceRoute {
   std::string message_;
   std::unique_ptr<DnsResolver> resolver_;
   std::unique_ptr<Prober> prober_;
+  std::shared_ptr<LocalStopSet> stop_set_;
+  std::shared_ptr<const AsnTable> asn_table_;
 };
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "asn.hpp"
+#include "test_helpers.hpp"
+
+class AsnTableTest : public ::testing::Test {
+ protected:
+  AsnTable build(const std::string& dataset) {
+    std::istringstream in(dataset);
+    AsnTableBuilder builder;
+    builder.add_dataset(in);
+    builder.write(file_.path());
+    return AsnTable(file_.path());
+  }
+
+  TempFile file_{".asn"};
+};
+
+TEST_F(AsnTableTest, FindsLongestMatchingPrefix) {
+  auto table = build(
+      "# prefix asn\n"
+      "8.0.0.0/8 3356\n"
+      "8.8.0.0/16 15169\n"
+      "\n"
+      "8.8.8.0/24 15170\n"
+      "8.8.8.128/25 15171\n"
+      "8.8.8.8/32 15172\n");
+
+  EXPECT_EQ(table.lookup("8.1.2.3")->asn, 3356u);
+  EXPECT_EQ(table.lookup("8.8.4.4")->asn, 15169u);
+  EXPECT_EQ(table.lookup("8.8.8.7")->asn, 15170u);
+  EXPECT_EQ(table.lookup("8.8.8.8")->asn, 15172u);
+  EXPECT_EQ(table.lookup("8.8.8.9")->asn, 15170u);
+  EXPECT_EQ(table.lookup("8.8.8.200")->asn, 15171u);
+}
+
+TEST_F(AsnTableTest, ReportsMatchedPrefix) {
+  auto table = build("8.8.8.128/25 15169\n");
+
+  auto info = table.lookup("8.8.8.200");
+
+  ASSERT_TRUE(info.has_value());
+  EXPECT_EQ(info->prefix_string(), "8.8.8.128/25");
+}
+
+TEST_F(AsnTableTest, IgnoresInsertionOrder) {
+  auto table = build(
+      "10.1.2.0/24 65002\n"
+      "10.0.0.0/8 65001\n");
+
+  EXPECT_EQ(table.lookup("10.1.2.3")->asn, 65002u);
+  EXPECT_EQ(table.lookup("10.1.3.3")->asn, 65001u);
+}
+
+TEST_F(AsnTableTest, ReturnsNulloptWithoutMatch) {
+  auto table = build("8.8.8.0/24 15169\n8.8.4.4/32 15169\n");
+
+  EXPECT_FALSE(table.lookup("1.1.1.1").has_value());
+  EXPECT_FALSE(table.lookup("8.8.4.5").has_value());
+  EXPECT_FALSE(table.lookup("not an ip").has_value());
+}
+
+TEST_F(AsnTableTest, ThrowsOnMalformedDataset) {
+  AsnTableBuilder builder;
+  std::istringstream missing_length("8.8.8.0 15169\n");
+  std::istringstream bad_length("8.8.8.0/33 15169\n");
+
+  EXPECT_THROW(builder.add_dataset(missing_length), std::runtime_error);
+  EXPECT_THROW(builder.add_dataset(bad_length), std::invalid_argument);
+}
+
+TEST_F(AsnTableTest, ThrowsOnNonTableFile) {
+  {
+    std::ofstream out(file_.path(), std::ios::binary);
+    out << "not an asn table";
+  }
+
+  EXPECT_THROW(AsnTable table(file_.path()), std::runtime_error);
+}
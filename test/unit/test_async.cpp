@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async.hpp"
+#include "test_helpers.hpp"
+
+// Replies instantly with route_reply() from a fixed route per destination
+class RouteTransport : public ProbeTransport {
+ public:
+  explicit RouteTransport(std::map<std::string, std::vector<std::string>> routes) : routes_(std::move(routes)) {}
+
+  void send(std::string_view dest_ip, int port, int ttl, std::string_view /*payload*/) override {
+    ++sent_;
+    HopResult reply = route_reply(routes_.at(std::string(dest_ip)), ttl);
+    if (reply.timed_out) {
+      return;
+    }
+    auto type = reply.reached_destination ? IcmpType::DestUnreachable : IcmpType::TimeExceeded;
+    inject(std::move(reply.sender_ip), type, dest_ip, port, static_cast<uint8_t>(reply.reply_ttl));
+  }
+
+  // Queues a reply as if it had arrived for a probe to `dest_ip` on `port`
+  void inject(std::string sender_ip, IcmpType type, std::string_view dest_ip, int port, uint8_t reply_ttl = 60) {
+    uint32_t dest_addr = 0;
+    inet_pton(AF_INET, std::string(dest_ip).c_str(), &dest_addr);
+    replies_.push_back({.sender_ip = std::move(sender_ip),
+                        .icmp = IcmpPacket{.type = type,
+                                           .original_dest_port = static_cast<uint16_t>(port),
+                                           .ttl = reply_ttl,
+                                           .original_dest_addr = dest_addr,
+                                           .original_source_port = 0}});
+  }
+
+  std::optional<IcmpResponse> receive() override {
+    if (replies_.empty()) {
+      return std::nullopt;
+    }
+    auto reply = std::move(replies_.front());
+    replies_.erase(replies_.begin());
+    return reply;
+  }
+
+  void wait(std::chrono::milliseconds timeout) override {
+    if (replies_.empty()) {
+      std::this_thread::sleep_for(timeout);
+    }
+  }
+
+  int sent() const { return sent_; }
+
+ private:
+  std::map<std::string, std::vector<std::string>> routes_;
+  std::vector<IcmpResponse> replies_;
+  int sent_ = 0;
+};
+
+class AsyncTraceTest : public ::testing::Test {
+ protected:
+  static constexpr auto kDestIp = "8.8.4.4";
+
+  void make_reactor(std::map<std::string, std::vector<std::string>> routes) {
+    auto transport = std::make_unique<RouteTransport>(std::move(routes));
+    transport_ = transport.get();
+    reactor_ = std::make_unique<Reactor>(std::move(transport));
+  }
+
+  Task<> collect(std::string dest_ip, TraceOptions options, std::vector<TraceHop>& hops) {
+    auto stream = trace(*reactor_, std::move(dest_ip), std::move(options));
+    while (auto hop = co_await stream.next()) {
+      hops.push_back(std::move(*hop));
+    }
+  }
+
+  // Requests a stop as soon as the first hop arrives
+  Task<> collect_one(TraceOptions options, std::stop_source& stop, std::vector<TraceHop>& hops) {
+    auto stream = trace(*reactor_, kDestIp, std::move(options));
+    while (auto hop = co_await stream.next()) {
+      hops.push_back(std::move(*hop));
+      stop.request_stop();
+    }
+  }
+
+  static Task<> await_first(HopStream& stream) { co_await stream.next(); }
+
+  static TraceOptions fast_options() {
+    TraceOptions options;
+    options.tries_per_hop = 1;
+    options.timeout = std::chrono::milliseconds(5);
+    return options;
+  }
+
+  std::unique_ptr<Reactor> reactor_;
+  RouteTransport* transport_ = nullptr;
+};
+
+TEST_F(AsyncTraceTest, YieldsHopsInOrder) {
+  make_reactor({{kDestIp, {"192.168.68.1", "10.0.0.1", kDestIp}}});
+  std::vector<TraceHop> hops;
+
+  reactor_->spawn(collect(kDestIp, fast_options(), hops));
+  reactor_->run();
+
+  ASSERT_EQ(hops.size(), 3u);
+  EXPECT_EQ(hops[0].ttl, 1);
+  EXPECT_EQ(hops[0].hop.sender_ip, "192.168.68.1");
+  EXPECT_EQ(hops[0].hop.reply_ttl, 255);
+  EXPECT_FALSE(hops[1].hop.reached_destination);
+  EXPECT_EQ(hops[2].hop.sender_ip, kDestIp);
+  EXPECT_TRUE(hops[2].hop.reached_destination);
+}
+
+TEST_F(AsyncTraceTest, AveragesTriesPerHop) {
+  make_reactor({{kDestIp, {kDestIp}}});
+  std::vector<TraceHop> hops;
+  auto options = fast_options();
+  options.tries_per_hop = 3;
+
+  reactor_->spawn(collect(kDestIp, options, hops));
+  reactor_->run();
+
+  ASSERT_EQ(hops.size(), 1u);
+  EXPECT_EQ(transport_->sent(), 3);
+}
+
+TEST_F(AsyncTraceTest, TimesOutSilentHops) {
+  make_reactor({{kDestIp, {"192.168.68.1", "*", kDestIp}}});
+  std::vector<TraceHop> hops;
+
+  reactor_->spawn(collect(kDestIp, fast_options(), hops));
+  reactor_->run();
+
+  ASSERT_EQ(hops.size(), 3u);
+  EXPECT_TRUE(hops[1].hop.timed_out);
+  EXPECT_TRUE(hops[2].hop.reached_destination);
+}
+
+TEST_F(AsyncTraceTest, RunsManyTracesConcurrently) {
+  std::map<std::string, std::vector<std::string>> routes;
+  for (int i = 0; i < 500; ++i) {
+    std::string dest = "10.1." + std::to_string(i / 256) + "." + std::to_string(i % 256);
+    routes[dest] = {"192.168.68.1", "*", "10.0.0.1", dest};
+  }
+  make_reactor(routes);
+  std::map<std::string, std::vector<TraceHop>> hops;
+
+  for (const auto& [dest, route] : routes) {
+    reactor_->spawn(collect(dest, fast_options(), hops[dest]));
+  }
+  // Every trace waits out its silent second hop at the same time, so this takes about one timeout
+  auto start = std::chrono::steady_clock::now();
+  reactor_->run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  for (const auto& [dest, route] : routes) {
+    ASSERT_EQ(hops[dest].size(), 4u) << dest;
+    EXPECT_EQ(hops[dest][3].hop.sender_ip, dest);
+  }
+  EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+}
+
+TEST_F(AsyncTraceTest, StopsWhenStopRequested) {
+  make_reactor({{kDestIp, {"192.168.68.1", "10.0.0.1", "10.0.0.2", kDestIp}}});
+  std::vector<TraceHop> hops;
+  std::stop_source stop;
+  auto options = fast_options();
+  options.stop = stop.get_token();
+
+  reactor_->spawn(collect_one(options, stop, hops));
+  reactor_->run();
+
+  EXPECT_EQ(hops.size(), 1u);
+  EXPECT_EQ(transport_->sent(), 1);
+}
+
+TEST_F(AsyncTraceTest, EndsAtDeadline) {
+  make_reactor({{kDestIp, {"*", "*", "*", kDestIp}}});
+  std::vector<TraceHop> hops;
+  auto options = fast_options();
+  options.timeout = std::chrono::milliseconds(1000);
+  options.deadline = Reactor::Clock::now() + std::chrono::milliseconds(20);
+
+  auto start = std::chrono::steady_clock::now();
+  reactor_->spawn(collect(kDestIp, options, hops));
+  reactor_->run();
+
+  ASSERT_EQ(hops.size(), 1u);
+  EXPECT_TRUE(hops[0].hop.timed_out);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+}
+
+TEST_F(AsyncTraceTest, YieldsNothingWhenDeadlineAlreadyPassed) {
+  make_reactor({{kDestIp, {"192.168.68.1", kDestIp}}});
+  std::vector<TraceHop> hops;
+  auto options = fast_options();
+  options.deadline = Reactor::Clock::now() - std::chrono::milliseconds(1);
+
+  reactor_->spawn(collect(kDestIp, options, hops));
+  reactor_->run();
+
+  EXPECT_TRUE(hops.empty());
+  EXPECT_EQ(transport_->sent(), 0);
+}
+
+TEST_F(AsyncTraceTest, IgnoresRepliesForOtherDestinations) {
+  make_reactor({{kDestIp, {"*", kDestIp}}});
+  std::vector<TraceHop> hops;
+  auto options = fast_options();
+  options.max_hops = 1;
+
+  reactor_->spawn(collect(kDestIp, options, hops));
+  // Same port as the pending probe, but quoting a probe to another host, e.g. from another reactor
+  transport_->inject("10.9.9.9", IcmpType::TimeExceeded, "1.1.1.1", 33434);
+  reactor_->run();
+
+  ASSERT_EQ(hops.size(), 1u);
+  EXPECT_TRUE(hops[0].hop.timed_out);
+}
+
+TEST_F(AsyncTraceTest, DestroyingStreamWithdrawsPendingProbe) {
+  make_reactor({{kDestIp, {"*", kDestIp}}});
+  {
+    auto stream = trace(*reactor_, kDestIp, fast_options());
+    reactor_->spawn(await_first(stream));
+    EXPECT_EQ(reactor_->pending_probes(), 1u);
+  }
+
+  EXPECT_EQ(reactor_->pending_probes(), 0u);
+}
+
+TEST_F(AsyncTraceTest, RunFailsInsteadOfSpinningOnStalledTasks) {
+  make_reactor({{kDestIp, {"*", kDestIp}}});
+  {
+    auto stream = trace(*reactor_, kDestIp, fast_options());
+    reactor_->spawn(await_first(stream));
+  }
+
+  // The task now waits on a stream that no longer exists, so there is nothing left to wait for
+  EXPECT_FALSE(reactor_->run_once());
+  EXPECT_EQ(reactor_->running_tasks(), 1u);
+  EXPECT_THROW(reactor_->run(), std::runtime_error);
+}
+
+TEST_F(AsyncTraceTest, PropagatesExceptionsFromSpawnedTasks) {
+  make_reactor({});
+  std::vector<TraceHop> hops;
+
+  // The route lookup in the transport throws for an unknown destination
+  reactor_->spawn(collect("192.0.2.1", fast_options(), hops));
+
+  EXPECT_THROW(reactor_->run(), std::out_of_range);
+}
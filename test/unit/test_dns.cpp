@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns.hpp"
+
+// Resolves "host-N" to "10.0.0.N" after a delay, fails on anything else, and tracks how many lookups
+// ran and how many overlapped
+class CountingDnsResolver : public DnsResolver {
+ public:
+  explicit CountingDnsResolver(std::map<std::string, std::chrono::milliseconds> delays = {})
+      : delays_(std::move(delays)) {}
+
+  std::string resolve(std::string_view hostname) override {
+    std::string name(hostname);
+    ++calls_;
+    int running = ++in_flight_;
+    int peak = peak_in_flight_.load();
+    while (running > peak && !peak_in_flight_.compare_exchange_weak(peak, running)) {
+    }
+
+    auto delay = delays_.contains(name) ? delays_.at(name) : std::chrono::milliseconds(5);
+    std::this_thread::sleep_for(delay);
+    --in_flight_;
+
+    if (!name.starts_with("host-")) {
+      throw std::runtime_error("Failed to resolve hostname: " + name);
+    }
+    return "10.0.0." + name.substr(5);
+  }
+
+  std::string reverse_resolve(std::string_view ip) override { return std::string(ip); }
+
+  int calls() const { return calls_; }
+  int in_flight() const { return in_flight_; }
+  int peak_in_flight() const { return peak_in_flight_; }
+
+ private:
+  std::map<std::string, std::chrono::milliseconds> delays_;
+  std::atomic<int> calls_ = 0;
+  std::atomic<int> in_flight_ = 0;
+  std::atomic<int> peak_in_flight_ = 0;
+};
+
+class BatchResolverTest : public ::testing::Test {
+ protected:
+  void resolve_all(BatchResolver& batch, const std::vector<std::string>& targets) {
+    batch.resolve_all(targets, [&](const std::string& target, const BatchResolver::Result& ip) {
+      order_.push_back(target);
+      results_.emplace(target, ip ? *ip : "error: " + ip.error());
+    });
+  }
+
+  std::vector<std::string> order_;
+  std::multimap<std::string, std::string> results_;
+};
+
+TEST(IpLiteralTest, ParsesIpv4Literals) {
+  EXPECT_EQ(parse_ip_literal("8.8.4.4"), "8.8.4.4");
+  EXPECT_FALSE(parse_ip_literal("dns.google.com").has_value());
+  EXPECT_FALSE(parse_ip_literal("8.8.4").has_value());
+}
+
+TEST(OfflineDnsResolverTest, ResolvesHostnameToRecordedDestination) {
+  OfflineDnsResolver resolver({"8.8.4.4"});
+
+  EXPECT_EQ(resolver.resolve("dns.google.com"), "8.8.4.4");
+  EXPECT_EQ(resolver.resolve("1.1.1.1"), "1.1.1.1");
+  EXPECT_EQ(resolver.reverse_resolve("192.168.68.1"), "192.168.68.1");
+}
+
+TEST(OfflineDnsResolverTest, ThrowsForHostnameWhenDestinationIsAmbiguous) {
+  OfflineDnsResolver resolver({"8.8.4.4", "1.1.1.1"});
+
+  EXPECT_THROW(resolver.resolve("dns.google.com"), std::runtime_error);
+  EXPECT_EQ(resolver.resolve("1.1.1.1"), "1.1.1.1");
+}
+
+TEST_F(BatchResolverTest, ReportsLiteralsWithoutResolver) {
+  CountingDnsResolver resolver;
+  BatchResolver batch(resolver);
+
+  resolve_all(batch, {"8.8.4.4", "1.1.1.1"});
+
+  EXPECT_EQ(resolver.calls(), 0);
+  EXPECT_EQ(order_, (std::vector<std::string>{"8.8.4.4", "1.1.1.1"}));
+}
+
+TEST_F(BatchResolverTest, ResolvesEachHostnameOnce) {
+  CountingDnsResolver resolver;
+  BatchResolver batch(resolver);
+
+  resolve_all(batch, {"host-1", "host-2", "host-1", "host-1"});
+
+  EXPECT_EQ(resolver.calls(), 2);
+  EXPECT_EQ(results_.count("host-1"), 3u);
+  EXPECT_EQ(results_.find("host-1")->second, "10.0.0.1");
+  EXPECT_EQ(results_.find("host-2")->second, "10.0.0.2");
+}
+
+TEST_F(BatchResolverTest, ReportsFailuresPerTarget) {
+  CountingDnsResolver resolver;
+  BatchResolver batch(resolver);
+
+  resolve_all(batch, {"host-1", "invalid.hostname.zzz"});
+
+  EXPECT_EQ(results_.find("host-1")->second, "10.0.0.1");
+  EXPECT_EQ(results_.find("invalid.hostname.zzz")->second, "error: Failed to resolve hostname: invalid.hostname.zzz");
+}
+
+TEST_F(BatchResolverTest, BoundsLookupsInFlight) {
+  CountingDnsResolver resolver;
+  BatchResolver batch(resolver, 3);
+  std::vector<std::string> targets;
+  for (int i = 0; i < 12; ++i) {
+    targets.push_back("host-" + std::to_string(i));
+  }
+
+  resolve_all(batch, targets);
+
+  EXPECT_EQ(resolver.calls(), 12);
+  EXPECT_EQ(results_.size(), 12u);
+  EXPECT_LE(resolver.peak_in_flight(), 3);
+  EXPECT_GT(resolver.peak_in_flight(), 1);
+}
+
+TEST_F(BatchResolverTest, ReportsFastLookupsBeforeSlowOnes) {
+  CountingDnsResolver resolver({{"host-1", std::chrono::milliseconds(200)}});
+  BatchResolver batch(resolver);
+  int in_flight_during_literal = 0;
+
+  batch.resolve_all({"host-1", "host-2", "8.8.4.4"}, [&](const std::string& target, const BatchResolver::Result&) {
+    if (target == "8.8.4.4") {
+      // Give the workers a moment to pick up their hostnames; none would exist if literals came first
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+      while (resolver.in_flight() == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+      }
+      in_flight_during_literal = resolver.in_flight();
+    }
+    order_.push_back(target);
+  });
+
+  EXPECT_EQ(order_, (std::vector<std::string>{"8.8.4.4", "host-2", "host-1"}));
+  EXPECT_GT(in_flight_during_literal, 0);
+}
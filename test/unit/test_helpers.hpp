@@ -0,0 +1,65 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "prober.hpp"
+
+// Answers a probe from a fixed route: hop `ttl` is route[ttl - 1] and the last entry is the destination.
+// Probes beyond the end of the route are answered like the last entry, and "*" never answers. Replies
+// carry the TTL left after travelling back from an initial 255 (routers) or 64 (the destination), so
+// distances can be estimated from them.
+inline HopResult route_reply(const std::vector<std::string>& route, int ttl) {
+  const auto hop = std::min(static_cast<std::size_t>(ttl - 1), route.size() - 1);
+  if (route[hop] == "*") {
+    return HopResult::timed_out_hop();
+  }
+  if (hop + 1 == route.size()) {
+    return HopResult::reached(route[hop], 1.0, 64 - static_cast<int>(hop));
+  }
+  return HopResult::transit(route[hop], 1.0, 255 - static_cast<int>(hop));
+}
+
+// Answers every probe with route_reply() for the current route, whatever the destination, and records
+// the TTLs probed
+class RouteProber : public Prober {
+ public:
+  explicit RouteProber(std::vector<std::string> route) : route_(std::move(route)) {}
+
+  HopResult send_probe(std::string_view /*dest_ip*/, int /*port*/, int ttl, std::string_view /*payload*/) override {
+    probed_ttls_.push_back(ttl);
+    return route_reply(route_, ttl);
+  }
+
+  void set_route(std::vector<std::string> route) { route_ = std::move(route); }
+  int probe_count() const { return static_cast<int>(probed_ttls_.size()); }
+  const std::vector<int>& probed_ttls() const { return probed_ttls_; }
+
+ private:
+  std::vector<std::string> route_;
+  std::vector<int> probed_ttls_;
+};
+
+// A per-process path in the temp directory, removed when the test is done with it
+class TempFile {
+ public:
+  explicit TempFile(std::string_view extension)
+      : path_((std::filesystem::temp_directory_path() /
+               ("cctraceroute_test_" + std::to_string(::getpid()) + std::string(extension)))
+                  .string()) {}
+
+  ~TempFile() { std::filesystem::remove(path_); }
+
+  TempFile(const TempFile&) = delete;
+  TempFile& operator=(const TempFile&) = delete;
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+};
@@ -166,3 +166,31 @@ TEST(IcmpParseTest, ReturnsNulloptForNonIcmpProtocol) {
 
   EXPECT_FALSE(result.has_value());
 }
+
+TEST(IcmpParseTest, ExposesReplyTtl) {
+  auto packet = make_icmp_packet(ICMP_DEST_UNREACH, 33434, 3);
+  auto* outer_ip = reinterpret_cast<struct iphdr*>(packet.data());
+  outer_ip->ttl = 57;
+
+  auto result = parse_icmp(std::span<const uint8_t>(packet));
+
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(result->ttl, 57);
+}
+
+TEST(IcmpParseTest, ExposesOriginalDestinationAndSourcePort) {
+  auto packet = make_icmp_packet(ICMP_TIME_EXCEEDED, 33434);
+  auto* inner_ip = reinterpret_cast<struct iphdr*>(packet.data() + sizeof(struct iphdr) + sizeof(struct icmphdr));
+  inet_pton(AF_INET, "8.8.4.4", &inner_ip->daddr);
+  auto* udp = reinterpret_cast<struct udphdr*>(packet.data() + sizeof(struct iphdr) + sizeof(struct icmphdr) +
+                                               sizeof(struct iphdr));
+  udp->source = htons(51000);
+
+  auto result = parse_icmp(std::span<const uint8_t>(packet));
+
+  ASSERT_TRUE(result.has_value());
+  uint32_t expected_addr = 0;
+  inet_pton(AF_INET, "8.8.4.4", &expected_addr);
+  EXPECT_EQ(result->original_dest_addr, expected_addr);
+  EXPECT_EQ(result->original_source_port, 51000);
+}
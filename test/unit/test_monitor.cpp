@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "monitor.hpp"
+#include "test_helpers.hpp"
+
+class PathMonitorTest : public ::testing::Test {
+ protected:
+  static constexpr auto kDestIp = "8.8.4.4";
+
+  PathMonitor make_monitor(std::vector<std::string> route, int tries_per_hop = 1) {
+    auto prober = std::make_unique<RouteProber>(std::move(route));
+    prober_ = prober.get();
+    return PathMonitor(64, tries_per_hop, "payload", std::move(prober));
+  }
+
+  static std::vector<std::string> long_route() {
+    std::vector<std::string> route;
+    for (int i = 1; i < 15; ++i) {
+      route.push_back("10.0.0." + std::to_string(i));
+    }
+    route.push_back(kDestIp);
+    return route;
+  }
+
+  RouteProber* prober_ = nullptr;
+};
+
+TEST_F(PathMonitorTest, FirstCheckReportsWholePath) {
+  auto monitor = make_monitor({"192.168.68.1", "10.0.0.1", kDestIp});
+
+  auto changes = monitor.check(kDestIp);
+
+  ASSERT_EQ(changes.size(), 3u);
+  EXPECT_EQ(changes[0].ttl, 1);
+  EXPECT_EQ(changes[0].previous, "");
+  EXPECT_EQ(changes[0].current, "192.168.68.1");
+  EXPECT_EQ(changes[2].current, kDestIp);
+  ASSERT_NE(monitor.known_path(kDestIp), nullptr);
+  EXPECT_EQ(monitor.known_path(kDestIp)->size(), 3u);
+}
+
+TEST_F(PathMonitorTest, StablePathReportsNoChangesWithFewProbes) {
+  auto monitor = make_monitor(long_route(), 3);
+  monitor.check(kDestIp);
+  int full_trace_probes = prober_->probe_count();
+
+  auto changes = monitor.check(kDestIp);
+
+  EXPECT_TRUE(changes.empty());
+  EXPECT_EQ(full_trace_probes, 45);
+  // Destination, the hop before it and 3 sampled hops, one probe each
+  EXPECT_EQ(prober_->probe_count() - full_trace_probes, 5);
+}
+
+TEST_F(PathMonitorTest, ReportsChangedResponder) {
+  auto route = long_route();
+  auto monitor = make_monitor(route);
+  monitor.check(kDestIp);
+
+  // Hop 7 is one of the sampled TTLs (15 * 2 / 4)
+  route[6] = "172.16.0.7";
+  prober_->set_route(route);
+  auto changes = monitor.check(kDestIp);
+
+  ASSERT_EQ(changes.size(), 1u);
+  EXPECT_EQ(changes[0].ttl, 7);
+  EXPECT_EQ(changes[0].previous, "10.0.0.7");
+  EXPECT_EQ(changes[0].current, "172.16.0.7");
+  EXPECT_EQ(monitor.known_path(kDestIp)->at(6).sender_ip, "172.16.0.7");
+}
+
+TEST_F(PathMonitorTest, ReportsShorterPath) {
+  auto monitor = make_monitor({"192.168.68.1", "10.0.0.1", "10.0.0.2", kDestIp});
+  monitor.check(kDestIp);
+
+  prober_->set_route({"192.168.68.1", "10.0.0.1", kDestIp});
+  auto changes = monitor.check(kDestIp);
+
+  ASSERT_EQ(changes.size(), 2u);
+  EXPECT_EQ(changes[0].ttl, 3);
+  EXPECT_EQ(changes[0].current, kDestIp);
+  EXPECT_EQ(changes[1].ttl, 4);
+  EXPECT_EQ(changes[1].previous, kDestIp);
+  EXPECT_EQ(changes[1].current, "");
+}
+
+TEST_F(PathMonitorTest, ReportsLongerPath) {
+  auto monitor = make_monitor({"192.168.68.1", kDestIp});
+  monitor.check(kDestIp);
+
+  prober_->set_route({"192.168.68.1", "10.0.0.1", kDestIp});
+  auto changes = monitor.check(kDestIp);
+
+  ASSERT_EQ(changes.size(), 2u);
+  EXPECT_EQ(changes[0].ttl, 2);
+  EXPECT_EQ(changes[0].current, "10.0.0.1");
+  EXPECT_EQ(changes[1].ttl, 3);
+  EXPECT_EQ(changes[1].previous, "");
+}
+
+TEST_F(PathMonitorTest, IgnoresSampledHopTimingOut) {
+  auto route = long_route();
+  auto monitor = make_monitor(route);
+  monitor.check(kDestIp);
+  int probes = prober_->probe_count();
+
+  route[6] = "*";
+  prober_->set_route(route);
+  auto changes = monitor.check(kDestIp);
+
+  EXPECT_TRUE(changes.empty());
+  EXPECT_EQ(prober_->probe_count() - probes, 5);
+}
+
+TEST_F(PathMonitorTest, ReportsDestinationGoingSilent) {
+  auto route = long_route();
+  auto monitor = make_monitor(route, 3);
+  monitor.check(kDestIp);
+
+  route.back() = "*";
+  prober_->set_route(route);
+  auto changes = monitor.check(kDestIp);
+
+  ASSERT_EQ(changes.size(), 1u);
+  EXPECT_EQ(changes[0].ttl, 15);
+  EXPECT_EQ(changes[0].previous, kDestIp);
+  EXPECT_EQ(changes[0].current, "");
+}
+
+TEST_F(PathMonitorTest, ReportsBlackholeAndRecovery) {
+  auto route = long_route();
+  auto monitor = make_monitor(route);
+  monitor.check(kDestIp);
+
+  // Nothing answers past hop 5
+  prober_->set_route({"10.0.0.1", "10.0.0.2", "10.0.0.3", "10.0.0.4", "10.0.0.5", "*"});
+  auto changes = monitor.check(kDestIp);
+
+  ASSERT_EQ(changes.size(), 10u);
+  EXPECT_EQ(changes[0].ttl, 6);
+  EXPECT_EQ(changes[0].current, "");
+  EXPECT_EQ(monitor.known_path(kDestIp)->size(), 5u);
+  EXPECT_TRUE(monitor.check(kDestIp).empty());
+
+  prober_->set_route(route);
+  changes = monitor.check(kDestIp);
+
+  ASSERT_EQ(changes.size(), 10u);
+  EXPECT_EQ(changes[9].current, kDestIp);
+}
+
+TEST(PathChangeTest, PrintsChange) {
+  std::ostringstream out;
+
+  print_path_change(out, {.ttl = 3, .previous = "10.0.0.1", .current = ""});
+
+  EXPECT_EQ(out.str(), " 3  10.0.0.1 -> -\n");
+}
@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "prober.hpp"
+#include "test_helpers.hpp"
+
+// Builds the ICMP reply a router or the destination sends back for a probe:
+// [outer IP (20 bytes)][ICMP header (8 bytes)][inner IP (20 bytes)][UDP header (8 bytes)]
+static std::vector<uint8_t> make_reply_packet(const char* sender_ip, uint8_t icmp_type, uint16_t dest_port) {
+  std::vector<uint8_t> packet(
+      sizeof(struct iphdr) + sizeof(struct icmphdr) + sizeof(struct iphdr) + sizeof(struct udphdr), 0);
+
+  auto* outer_ip = reinterpret_cast<struct iphdr*>(packet.data());
+  outer_ip->version = 4;
+  outer_ip->ihl = 5;
+  outer_ip->protocol = IPPROTO_ICMP;
+  inet_pton(AF_INET, sender_ip, &outer_ip->saddr);
+
+  auto* icmp = reinterpret_cast<struct icmphdr*>(packet.data() + sizeof(struct iphdr));
+  icmp->type = icmp_type;
+
+  auto* inner_ip = reinterpret_cast<struct iphdr*>(packet.data() + sizeof(struct iphdr) + sizeof(struct icmphdr));
+  inner_ip->version = 4;
+  inner_ip->ihl = 5;
+
+  auto* udp = reinterpret_cast<struct udphdr*>(packet.data() + sizeof(struct iphdr) + sizeof(struct icmphdr) +
+                                               sizeof(struct iphdr));
+  udp->dest = htons(dest_port);
+
+  return packet;
+}
+
+class PcapTest : public ::testing::Test {
+ protected:
+  static constexpr auto kDestIp = "8.8.4.4";
+  static constexpr auto kPayload = "codingchallenges.fyi trace route";
+
+  std::chrono::system_clock::time_point at_ms(int ms) { return start_ + std::chrono::milliseconds(ms); }
+
+  TempFile file_{".pcap"};
+  std::chrono::system_clock::time_point start_ = std::chrono::system_clock::now();
+};
+
+TEST_F(PcapTest, RoundTripsRecordsWithTimestamps) {
+  auto probe = make_probe_packet(kDestIp, 33434, 1, kPayload);
+  auto reply = make_reply_packet("192.168.68.1", ICMP_TIME_EXCEEDED, 33434);
+  {
+    PcapWriter writer(file_.path());
+    writer.write(probe, at_ms(0));
+    writer.write(reply, at_ms(5));
+  }
+
+  PcapReader reader(file_.path());
+  auto first = reader.next();
+  auto second = reader.next();
+
+  ASSERT_TRUE(first.has_value());
+  ASSERT_TRUE(second.has_value());
+  EXPECT_EQ(std::vector<uint8_t>(first->data.begin(), first->data.end()), probe);
+  EXPECT_EQ(std::vector<uint8_t>(second->data.begin(), second->data.end()), reply);
+  EXPECT_EQ(second->timestamp - first->timestamp, std::chrono::milliseconds(5));
+  EXPECT_FALSE(reader.next().has_value());
+}
+
+TEST_F(PcapTest, CapturedRepliesParseAsIcmp) {
+  {
+    PcapWriter writer(file_.path());
+    writer.write(make_reply_packet("8.8.4.4", ICMP_DEST_UNREACH, 33435));
+  }
+
+  PcapReader reader(file_.path());
+  auto record = reader.next();
+  ASSERT_TRUE(record.has_value());
+  auto icmp = parse_icmp(record->data);
+
+  ASSERT_TRUE(icmp.has_value());
+  EXPECT_EQ(icmp->type, IcmpType::DestUnreachable);
+  EXPECT_EQ(icmp->original_dest_port, 33435);
+}
+
+TEST_F(PcapTest, ThrowsOnNonPcapFile) {
+  {
+    std::ofstream out(file_.path(), std::ios::binary);
+    out << "definitely not a capture file";
+  }
+
+  EXPECT_THROW(PcapReader reader(file_.path()), std::runtime_error);
+}
+
+TEST_F(PcapTest, ReplayProberAnswersFromCapture) {
+  {
+    PcapWriter writer(file_.path());
+    writer.write(make_probe_packet(kDestIp, 33434, 1, kPayload), at_ms(0));
+    writer.write(make_reply_packet("192.168.68.1", ICMP_TIME_EXCEEDED, 33434), at_ms(5));
+    writer.write(make_probe_packet(kDestIp, 33435, 2, kPayload), at_ms(10));
+    writer.write(make_probe_packet(kDestIp, 33436, 3, kPayload), at_ms(20));
+    writer.write(make_reply_packet("10.0.0.1", ICMP_TIME_EXCEEDED, 33435), at_ms(21));
+    writer.write(make_reply_packet("8.8.4.4", ICMP_DEST_UNREACH, 33436), at_ms(50));
+  }
+
+  ReplayProber prober(file_.path());
+  auto hop1 = prober.send_probe(kDestIp, 33434, 1, kPayload);
+  auto hop2 = prober.send_probe(kDestIp, 33435, 2, kPayload);
+  auto hop3 = prober.send_probe(kDestIp, 33436, 3, kPayload);
+
+  EXPECT_EQ(hop1.sender_ip, "192.168.68.1");
+  EXPECT_DOUBLE_EQ(hop1.rtt_ms, 5.0);
+  EXPECT_FALSE(hop1.reached_destination);
+
+  // The reply to probe 2 only showed up after probe 3 went out, so it timed out live and must time out here
+  EXPECT_TRUE(hop2.timed_out);
+
+  EXPECT_EQ(hop3.sender_ip, "8.8.4.4");
+  EXPECT_DOUBLE_EQ(hop3.rtt_ms, 30.0);
+  EXPECT_TRUE(hop3.reached_destination);
+}
+
+TEST_F(PcapTest, ReplayProberThrowsForUnrecordedProbe) {
+  {
+    PcapWriter writer(file_.path());
+    writer.write(make_probe_packet(kDestIp, 33434, 1, kPayload), at_ms(0));
+  }
+
+  ReplayProber prober(file_.path());
+
+  EXPECT_THROW(prober.send_probe(kDestIp, 33500, 1, kPayload), std::runtime_error);
+}
+
+TEST_F(PcapTest, ReplayProberListsRecordedDestinations) {
+  {
+    PcapWriter writer(file_.path());
+    writer.write(make_probe_packet(kDestIp, 33434, 1, kPayload), at_ms(0));
+    writer.write(make_probe_packet("1.1.1.1", 33434, 1, kPayload), at_ms(1));
+    writer.write(make_probe_packet(kDestIp, 33435, 1, kPayload), at_ms(2));
+  }
+
+  ReplayProber prober(file_.path());
+
+  EXPECT_EQ(prober.destinations(), (std::vector<std::string>{kDestIp, "1.1.1.1"}));
+}
+
+TEST_F(PcapTest, SharedReplayProberReplaysEachRunOfADestination) {
+  {
+    PcapWriter writer(file_.path());
+    writer.write(make_probe_packet(kDestIp, 33434, 1, kPayload), at_ms(0));
+    writer.write(make_reply_packet("10.0.0.1", ICMP_TIME_EXCEEDED, 33434), at_ms(5));
+    writer.write(make_probe_packet(kDestIp, 33434, 1, kPayload), at_ms(100));
+    writer.write(make_reply_packet("10.0.0.2", ICMP_TIME_EXCEEDED, 33434), at_ms(105));
+  }
+
+  // One prober per traced target, as the CLI creates them, over a single replay
+  auto replay = std::make_shared<ReplayProber>(file_.path());
+  SharedProber first_run(replay);
+  SharedProber second_run(replay);
+
+  EXPECT_EQ(first_run.send_probe(kDestIp, 33434, 1, kPayload).sender_ip, "10.0.0.1");
+  EXPECT_EQ(second_run.send_probe(kDestIp, 33434, 1, kPayload).sender_ip, "10.0.0.2");
+}
@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "test_helpers.hpp"
+#include "topology.hpp"
+
+using Link = TopologyStore::Link;
+
+static std::vector<HopResult> make_path(const std::vector<std::string>& ips) {
+  std::vector<HopResult> hops;
+  for (const auto& ip : ips) {
+    hops.push_back(ip == "*" ? HopResult::timed_out_hop() : HopResult::transit(ip, 1.0));
+  }
+  return hops;
+}
+
+class TopologyTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    store_.add_trace("8.8.4.4", make_path({"192.168.68.1", "10.0.0.1", "8.8.4.4"}));
+    store_.add_trace("1.1.1.1", make_path({"192.168.68.1", "10.0.0.1", "*", "1.1.1.1"}));
+    store_.add_trace("9.9.9.9", make_path({"192.168.68.1", "10.0.0.2", "9.9.9.9"}));
+  }
+
+  TopologyStore::AddressId id(const char* ip) { return *store_.find_address(ip); }
+
+  TopologyStore store_;
+  TempFile file_{".topo"};
+};
+
+TEST_F(TopologyTest, InternsEachAddressOnce) {
+  // 192.168.68.1, 10.0.0.1, 10.0.0.2, 8.8.4.4, 1.1.1.1, 9.9.9.9
+  EXPECT_EQ(store_.address_count(), 6u);
+  EXPECT_EQ(store_.intern("10.0.0.1"), id("10.0.0.1"));
+}
+
+TEST_F(TopologyTest, SharesCommonPrefixes) {
+  // 192.168.68.1 -> 10.0.0.1 -> {8.8.4.4, * -> 1.1.1.1}, 192.168.68.1 -> 10.0.0.2 -> 9.9.9.9
+  EXPECT_EQ(store_.node_count(), 7u);
+}
+
+TEST_F(TopologyTest, ReconstructsPaths) {
+  EXPECT_EQ(store_.trace_count(), 3u);
+  EXPECT_EQ(store_.destination(1), "1.1.1.1");
+  EXPECT_EQ(store_.path(1), (std::vector<std::string>{"192.168.68.1", "10.0.0.1", "*", "1.1.1.1"}));
+}
+
+TEST_F(TopologyTest, FindsTracesCrossingInterface) {
+  EXPECT_EQ(store_.traces_crossing("10.0.0.1"), (std::vector<TopologyStore::TraceId>{0, 1}));
+  EXPECT_EQ(store_.traces_crossing("192.168.68.1"), (std::vector<TopologyStore::TraceId>{0, 1, 2}));
+  EXPECT_TRUE(store_.traces_crossing("203.0.113.1").empty());
+}
+
+TEST_F(TopologyTest, CountsTraceOnceWhenInterfaceRepeats) {
+  auto looped = store_.add_trace("8.8.8.8", make_path({"192.168.68.1", "10.0.0.3", "10.0.0.3", "8.8.8.8"}));
+
+  EXPECT_EQ(store_.traces_crossing("10.0.0.3"), (std::vector<TopologyStore::TraceId>{looped}));
+}
+
+TEST_F(TopologyTest, ListsLinksAtTtl) {
+  EXPECT_EQ(store_.links_at_ttl(1), (std::vector<Link>{{id("192.168.68.1"), id("10.0.0.1")},
+                                                       {id("192.168.68.1"), id("10.0.0.2")}}));
+  // 10.0.0.1 -> * is skipped because the far end did not answer
+  EXPECT_EQ(store_.links_at_ttl(2),
+            (std::vector<Link>{{id("10.0.0.1"), id("8.8.4.4")}, {id("10.0.0.2"), id("9.9.9.9")}}));
+  EXPECT_TRUE(store_.links_at_ttl(10).empty());
+}
+
+TEST_F(TopologyTest, RoundTripsThroughSnapshot) {
+  store_.save(file_.path());
+  auto loaded = TopologyStore::load(file_.path());
+
+  EXPECT_EQ(loaded.trace_count(), 3u);
+  EXPECT_EQ(loaded.node_count(), 7u);
+  EXPECT_EQ(loaded.path(2), store_.path(2));
+  EXPECT_EQ(loaded.traces_crossing("10.0.0.1"), (std::vector<TopologyStore::TraceId>{0, 1}));
+}
+
+TEST_F(TopologyTest, KeepsSharingPrefixesAfterReload) {
+  store_.save(file_.path());
+  auto loaded = TopologyStore::load(file_.path());
+
+  loaded.add_trace("8.8.4.4", make_path({"192.168.68.1", "10.0.0.1", "8.8.4.4"}));
+
+  EXPECT_EQ(loaded.node_count(), 7u);
+  EXPECT_EQ(loaded.traces_crossing("8.8.4.4"), (std::vector<TopologyStore::TraceId>{0, 3}));
+}
+
+TEST_F(TopologyTest, SavesOverTheSnapshotItWasLoadedFrom) {
+  store_.save(file_.path());
+  {
+    auto loaded = TopologyStore::load(file_.path());
+    // Nothing was changed, so every array is still read from the mapping of the file being replaced
+    loaded.save(file_.path());
+  }
+
+  auto reloaded = TopologyStore::load(file_.path());
+
+  EXPECT_EQ(reloaded.trace_count(), 3u);
+  EXPECT_EQ(reloaded.path(1), store_.path(1));
+}
+
+TEST_F(TopologyTest, FindsAddressesInternedAfterReload) {
+  store_.save(file_.path());
+  auto loaded = TopologyStore::load(file_.path());
+
+  auto added = loaded.intern("203.0.113.1");
+
+  EXPECT_EQ(loaded.find_address("203.0.113.1"), added);
+  EXPECT_EQ(loaded.find_address("10.0.0.2"), store_.find_address("10.0.0.2"));
+  EXPECT_FALSE(loaded.find_address("203.0.113.2").has_value());
+}
+
+TEST_F(TopologyTest, RejectsOutOfRangeIndices) {
+  store_.save(file_.path());
+  std::vector<char> bytes;
+  {
+    std::ifstream in(file_.path(), std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), {});
+  }
+
+  // Every word after the magic is an index or count; each corrupted one must be rejected or stay in bounds
+  for (std::size_t offset = 8; offset + 4 <= bytes.size(); offset += 4) {
+    auto corrupt = bytes;
+    const uint32_t value = 0x7fffffff;
+    std::memcpy(corrupt.data() + offset, &value, sizeof(value));
+    {
+      std::ofstream out(file_.path(), std::ios::binary | std::ios::trunc);
+      out.write(corrupt.data(), static_cast<std::streamsize>(corrupt.size()));
+    }
+
+    try {
+      auto loaded = TopologyStore::load(file_.path());
+      for (TopologyStore::TraceId trace = 0; trace < loaded.trace_count(); ++trace) {
+        for (const auto& ip : loaded.path(trace)) {
+          if (ip != "*") {
+            loaded.traces_crossing(ip);
+          }
+        }
+      }
+      for (int ttl = 1; ttl < 5; ++ttl) {
+        loaded.links_at_ttl(ttl);
+      }
+    } catch (const std::runtime_error&) {
+    }
+  }
+}
+
+TEST_F(TopologyTest, ThrowsOnInvalidSnapshot) {
+  {
+    std::ofstream out(file_.path(), std::ios::binary);
+    out << "not a snapshot at all";
+  }
+
+  EXPECT_THROW(TopologyStore::load(file_.path()), std::runtime_error);
+}
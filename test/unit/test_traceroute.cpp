@@ -4,6 +4,7 @@
 #include <sstream>
 #include <vector>
 
+#include "test_helpers.hpp"
 #include "traceroute.hpp"
 
 class StubDnsResolver : public DnsResolver {
@@ -205,3 +206,146 @@ TEST_F(TracerouteTest, MultipleProbesPerHopCallsProberCorrectly) {
 
   EXPECT_EQ(prober_->call_count(), 6);
 }
+
+TEST_F(TracerouteTest, ReturnsTracedPath) {
+  auto traceroute = make_traceroute({
+      HopResult::transit("192.168.68.1", 5.0),
+      HopResult::timed_out_hop(),
+      HopResult::reached("8.8.4.4", 30.0),
+  });
+
+  auto result = traceroute.run(out_);
+
+  EXPECT_EQ(result.destination_ip, "8.8.4.4");
+  ASSERT_EQ(result.hops.size(), 3u);
+  EXPECT_EQ(result.hops[0].sender_ip, "192.168.68.1");
+  EXPECT_TRUE(result.hops[1].timed_out);
+  EXPECT_TRUE(result.hops[2].reached_destination);
+}
+
+TEST(EstimateHopCountTest, UsesClosestInitialTtl) {
+  EXPECT_EQ(estimate_hop_count(64), 1);
+  EXPECT_EQ(estimate_hop_count(52), 13);
+  EXPECT_EQ(estimate_hop_count(115), 14);
+  EXPECT_EQ(estimate_hop_count(250), 6);
+  EXPECT_FALSE(estimate_hop_count(0).has_value());
+}
+
+class MidpathTracerouteTest : public TracerouteTest {
+ protected:
+  TraceRoute make_midpath_traceroute(std::vector<std::string> route) {
+    auto prober = std::make_unique<RouteProber>(std::move(route));
+    route_prober_ = prober.get();
+    TraceRoute traceroute(kHostname, kMaxHops, 1, kMessage,
+                          std::make_unique<StubDnsResolver>(kResolvedIp, reverse_map_), std::move(prober));
+    traceroute.enable_midpath_start(stop_set_);
+    return traceroute;
+  }
+
+  std::shared_ptr<LocalStopSet> stop_set_ = std::make_shared<LocalStopSet>();
+  RouteProber* route_prober_ = nullptr;
+};
+
+TEST_F(MidpathTracerouteTest, StartsProbingMidPath) {
+  auto traceroute = make_midpath_traceroute({"10.0.0.1", "10.0.0.2", "10.0.0.3", "10.0.0.4", "10.0.0.5", "8.8.4.4"});
+
+  auto result = traceroute.run(out_);
+  std::string output = out_.str();
+
+  // Distance probe, then forward from TTL 3, then backward to TTL 1
+  EXPECT_EQ(route_prober_->probed_ttls(), (std::vector<int>{kMaxHops, 3, 4, 5, 6, 2, 1}));
+  ASSERT_EQ(result.hops.size(), 6u);
+  EXPECT_EQ(get_line(output, 1), " 1  10.0.0.1 (10.0.0.1) 1.000 ms");
+  EXPECT_EQ(get_line(output, 6), " 6  8.8.4.4 (8.8.4.4) 1.000 ms");
+}
+
+TEST_F(MidpathTracerouteTest, StopsBackwardProbingAtKnownHop) {
+  make_midpath_traceroute({"10.0.0.1", "10.0.0.2", "10.0.0.3", "8.8.8.8"}).run(out_);
+
+  auto traceroute = make_midpath_traceroute({"10.0.0.1", "10.0.0.2", "172.16.0.3", "172.16.0.4", "172.16.0.5",
+                                             "172.16.0.6", "172.16.0.7", "8.8.4.4"});
+  auto result = traceroute.run(out_);
+
+  // Forward from TTL 4; backward hits 172.16.0.3 (new) then 10.0.0.2 (known at TTL 2), so TTL 1 is not probed
+  EXPECT_EQ(route_prober_->probed_ttls(), (std::vector<int>{kMaxHops, 4, 5, 6, 7, 8, 3, 2}));
+  ASSERT_EQ(result.hops.size(), 8u);
+  EXPECT_EQ(result.hops[0].sender_ip, "10.0.0.1");
+  EXPECT_EQ(result.hops[1].sender_ip, "10.0.0.2");
+  EXPECT_EQ(result.hops[2].sender_ip, "172.16.0.3");
+}
+
+TEST_F(MidpathTracerouteTest, MarksHopsTakenFromEarlierTrace) {
+  make_midpath_traceroute({"10.0.0.1", "10.0.0.2", "10.0.0.3", "8.8.8.8"}).run(out_);
+  out_.str("");
+
+  auto result = make_midpath_traceroute({"10.0.0.1", "10.0.0.2", "172.16.0.3", "172.16.0.4", "8.8.4.4"}).run(out_);
+  std::string output = out_.str();
+
+  // TTL 2 was probed and matched the earlier trace; only TTL 1 was copied from it
+  ASSERT_EQ(result.hops.size(), 5u);
+  EXPECT_TRUE(result.hops[0].inferred);
+  EXPECT_DOUBLE_EQ(result.hops[0].rtt_ms, 0.0);
+  EXPECT_FALSE(result.hops[1].inferred);
+  EXPECT_EQ(get_line(output, 1), " 1  10.0.0.1 (10.0.0.1) inferred");
+  EXPECT_EQ(get_line(output, 2), " 2  10.0.0.2 (10.0.0.2) 1.000 ms");
+}
+
+TEST_F(MidpathTracerouteTest, HandlesDestinationCloserThanStart) {
+  // Reply TTL 60 suggests 5 hops, so probing starts at TTL 3, but the destination is only 2 hops away
+  auto prober = std::make_unique<StubProber>(std::vector<HopResult>{
+      HopResult::reached("8.8.4.4", 1.0, 60),
+      HopResult::reached("8.8.4.4", 1.0),
+      HopResult::reached("8.8.4.4", 1.0),
+      HopResult::transit("10.0.0.1", 1.0),
+  });
+  prober_ = prober.get();
+  TraceRoute traceroute(kHostname, kMaxHops, 1, kMessage, std::make_unique<StubDnsResolver>(kResolvedIp, reverse_map_),
+                        std::move(prober));
+  traceroute.enable_midpath_start(stop_set_);
+
+  auto result = traceroute.run(out_);
+
+  EXPECT_EQ(prober_->call_count(), 4);
+  ASSERT_EQ(result.hops.size(), 2u);
+  EXPECT_EQ(result.hops[0].sender_ip, "10.0.0.1");
+  EXPECT_TRUE(result.hops[1].reached_destination);
+}
+
+TEST_F(MidpathTracerouteTest, FallsBackToTtlOneWithoutDistance) {
+  auto prober = std::make_unique<StubProber>(std::vector<HopResult>{
+      HopResult::timed_out_hop(),
+      HopResult::transit("10.0.0.1", 1.0),
+      HopResult::reached("8.8.4.4", 2.0),
+  });
+  prober_ = prober.get();
+  TraceRoute traceroute(kHostname, kMaxHops, 1, kMessage, std::make_unique<StubDnsResolver>(kResolvedIp, reverse_map_),
+                        std::move(prober));
+  traceroute.enable_midpath_start(stop_set_);
+
+  auto result = traceroute.run(out_);
+
+  EXPECT_EQ(prober_->call_count(), 3);
+  ASSERT_EQ(result.hops.size(), 2u);
+  EXPECT_EQ(result.hops[1].sender_ip, "8.8.4.4");
+}
+
+TEST_F(TracerouteTest, AnnotatesHopsWithAsn) {
+  TempFile table(".asn");
+  AsnTableBuilder builder;
+  builder.add(0x08080400, 24, 15169);  // 8.8.4.0/24
+  builder.write(table.path());
+  auto traceroute = make_traceroute({
+      HopResult::transit("10.0.0.1", 1.0),
+      HopResult::reached("8.8.4.4", 2.0),
+  });
+  traceroute.enable_asn_annotation(std::make_shared<AsnTable>(table.path()));
+
+  auto result = traceroute.run(out_);
+  std::string output = out_.str();
+
+  EXPECT_EQ(get_line(output, 1), " 1  10.0.0.1 (10.0.0.1) [*] 1.000 ms");
+  EXPECT_EQ(get_line(output, 2), " 2  8.8.4.4 (8.8.4.4) [AS15169] 2.000 ms");
+  EXPECT_FALSE(result.hops[0].asn.has_value());
+  ASSERT_TRUE(result.hops[1].asn.has_value());
+  EXPECT_EQ(result.hops[1].asn->prefix_string(), "8.8.4.0/24");
+}